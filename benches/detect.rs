@@ -0,0 +1,227 @@
+// Detection benchmark without any X dependency
+//
+// Drives Layout::locate and Trigger::motion over synthetic layouts of 1, 3
+// and 12 monitors and a mixed one, a single monitor also on the generic
+// path, then replays a trace through replay::Player, and reports the time
+// and the allocations per event. Run with cargo bench --bench detect
+// [-- FILE], FILE is a trace written by --record, by default the walk over
+// the mixed layout is recorded.
+
+use std::alloc::GlobalAlloc;
+use std::alloc::Layout as AllocLayout;
+use std::alloc::System;
+use std::hint::black_box;
+use std::path::Path;
+use std::sync::atomic::AtomicU64;
+use std::sync::atomic::Ordering;
+use std::time::Duration;
+use std::time::Instant;
+use edges::layout::Layout;
+use edges::layout::Rect;
+use edges::replay::Player;
+use edges::replay::Record;
+use edges::replay::Recorder;
+use edges::trigger::Hit;
+use edges::trigger::Trigger;
+
+// Counts the allocations of the whole process
+struct Counting;
+
+static ALLOCATIONS: AtomicU64 = AtomicU64::new(0);
+
+unsafe impl GlobalAlloc for Counting {
+	unsafe fn alloc(&self, layout: AllocLayout) -> *mut u8
+	{
+		ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+		return System.alloc(layout);
+	}
+
+	unsafe fn dealloc(&self, ptr: *mut u8, layout: AllocLayout)
+	{
+		System.dealloc(ptr, layout);
+	}
+
+	unsafe fn realloc(&self, ptr: *mut u8, layout: AllocLayout, size: usize) -> *mut u8
+	{
+		ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+		return System.realloc(ptr, layout, size);
+	}
+}
+
+#[global_allocator]
+static ALLOCATOR: Counting = Counting;
+
+const EVENTS: usize = 1_000_000;
+
+// Monitors of 1920x1080 in a grid with the given number of columns
+fn grid(count: i32, columns: i32) -> Vec<Rect>
+{
+	return (0..count).map(|i| Rect { x: (i % columns) * 1920, y: (i / columns) * 1080, w: 1920, h: 1080 }).collect();
+}
+
+// A 2560x1440 monitor next to a rotated 1080x1920 one and a 1920x1080
+// one, lined up at neither top nor bottom
+fn mixed() -> Vec<Rect>
+{
+	return vec![
+		Rect { x: 0, y: 240, w: 2560, h: 1440 },
+		Rect { x: 2560, y: 0, w: 1080, h: 1920 },
+		Rect { x: 3640, y: 600, w: 1920, h: 1080 },
+	];
+}
+
+// Deterministic pointer walk over the layout with a push against the
+// bounds now and then, so all zones are hit
+fn walk(rects: &[Rect]) -> Vec<(i32, i32)>
+{
+	let width = rects.iter().map(|r| r.x + r.w).max().unwrap();
+	let height = rects.iter().map(|r| r.y + r.h).max().unwrap();
+	let mut seed: u64 = 0x2545f4914f6cdd1d;
+	let mut next = move || {
+		seed = seed.wrapping_mul(6364136223846793005).wrapping_add(1442695040888963407);
+		return (seed >> 33) as i32;
+	};
+
+	let (mut x, mut y) = (width / 2, height / 2);
+	let mut positions = Vec::with_capacity(EVENTS);
+	for _ in 0..EVENTS {
+		if next() % 64 == 0 {
+			x = if next() % 2 == 0 { 0 } else { width - 1 };
+		}
+		x = (x + next() % 81 - 40).clamp(0, width - 1);
+		y = (y + next() % 81 - 40).clamp(0, height - 1);
+		positions.push((x, y));
+	}
+
+	return positions;
+}
+
+fn report(name: &str, layout: &str, events: usize, elapsed: Duration, allocations: u64)
+{
+	println!("{:<8} {:<14} {:>8.2} ns/event {:>6.3} allocations/event", name, layout,
+		 elapsed.as_nanos() as f64 / events as f64, allocations as f64 / events as f64);
+}
+
+fn locate(name: &str, layout: &Layout, positions: &[(i32, i32)])
+{
+	let allocations = ALLOCATIONS.load(Ordering::Relaxed);
+	let start = Instant::now();
+	for &(x, y) in positions {
+		black_box(layout.locate(black_box(x), black_box(y)));
+	}
+	report("locate", name, positions.len(), start.elapsed(), ALLOCATIONS.load(Ordering::Relaxed) - allocations);
+}
+
+fn trigger(name: &str, layout: &Layout, positions: &[(i32, i32)])
+{
+	// Virtual time, 1 ms per event
+	let mut trigger = Trigger::new(Duration::ZERO, 1, 0, 0);
+	let base = Instant::now();
+	let mut fired = 0;
+
+	let allocations = ALLOCATIONS.load(Ordering::Relaxed);
+	let start = Instant::now();
+	for (i, &(x, y)) in positions.iter().enumerate() {
+		let now = base + Duration::from_millis(i as u64);
+		if let Hit::FIRE(_, _) = trigger.motion(layout, x, y, (0.0, 0.0), now) {
+			fired += 1;
+		}
+	}
+	report("trigger", name, positions.len(), start.elapsed(), ALLOCATIONS.load(Ordering::Relaxed) - allocations);
+	black_box(fired);
+}
+
+// Reads the trace and runs its motions through the trigger like
+// --replay-fast, reading included
+fn replay(name: &str, path: &Path)
+{
+	let mut player = match Player::open(path) {
+		Ok(player) => player,
+		Err(e) => {
+			eprintln!("{}", e);
+			return;
+		}
+	};
+	let mut trigger = Trigger::new(Duration::ZERO, 1, 0, 0);
+	let mut layout: Option<(u16, Layout)> = None;
+	let base = Instant::now();
+	let mut events = 0;
+
+	let allocations = ALLOCATIONS.load(Ordering::Relaxed);
+	let start = Instant::now();
+	while let Some(record) = player.next() {
+		match record {
+			Record::LAYOUT(generation, rects) => {
+				layout = Some((generation, Layout::new(0, 0, &rects)));
+				trigger.reset();
+			}
+			Record::MOTION { time, x, y, generation, delta } => match &layout {
+				Some((g, layout)) if *g == generation => {
+					black_box(trigger.motion(layout, x, y, delta, base + Duration::from_micros(time)));
+					events += 1;
+				}
+				_ => {}
+			},
+		}
+	}
+	let elapsed = start.elapsed();
+	let allocations = ALLOCATIONS.load(Ordering::Relaxed) - allocations;
+
+	if events > 0 {
+		report("replay", name, events, elapsed, allocations);
+	}
+}
+
+// Records the walk over the layout, 1 ms per event
+fn record(path: &Path, rects: &[Rect], positions: &[(i32, i32)]) -> Result<(), String>
+{
+	let mut recorder = Recorder::create(path)?;
+	let base = Instant::now();
+
+	recorder.layout(rects);
+	for (i, &(x, y)) in positions.iter().enumerate() {
+		recorder.motion(x, y, (0.0, 0.0), base + Duration::from_millis(i as u64));
+	}
+	recorder.flush();
+
+	return Ok(());
+}
+
+fn main()
+{
+	for (count, columns) in [(1, 1), (3, 3), (12, 4)] {
+		let rects = grid(count, columns);
+		let layout = Layout::new(0, 0, &rects);
+		let positions = walk(&rects);
+		let name = format!("{}x1920x1080", count);
+
+		locate(&name, &layout, &positions);
+		trigger(&name, &layout, &positions);
+
+		// The single monitor fast path against the grid
+		if count == 1 {
+			let layout = Layout::new(0, 0, &rects).generic();
+			locate("1x generic", &layout, &positions);
+			trigger("1x generic", &layout, &positions);
+		}
+	}
+
+	let rects = mixed();
+	let layout = Layout::new(0, 0, &rects);
+	let positions = walk(&rects);
+	locate("mixed", &layout, &positions);
+	trigger("mixed", &layout, &positions);
+
+	// Arguments of cargo bench itself start with -
+	match std::env::args().skip(1).find(|a| !a.starts_with('-')) {
+		Some(file) => replay("file", Path::new(&file)),
+		None => {
+			let path = std::env::temp_dir().join(format!("edges-bench-{}.edgr", std::process::id()));
+			match record(&path, &rects, &positions) {
+				Ok(()) => replay("mixed walk", &path),
+				Err(e) => eprintln!("{}", e),
+			}
+			let _ = std::fs::remove_file(&path);
+		}
+	}
+}
@@ -2,5 +2,14 @@ fn main() {
     println!("cargo:rustc-link-lib=X11");
     println!("cargo:rustc-link-lib=Xrandr");
     println!("cargo:rustc-link-lib=Xi");
+    println!("cargo:rustc-link-lib=Xfixes");
+    println!("cargo:rustc-link-lib=Xtst");
+    println!("cargo:rustc-link-lib=Xext");
+
+    if std::env::var_os("CARGO_FEATURE_XCB").is_some() {
+        println!("cargo:rustc-link-lib=xcb");
+        println!("cargo:rustc-link-lib=xcb-xinput");
+        println!("cargo:rustc-link-lib=xcb-randr");
+    }
 }
 
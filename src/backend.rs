@@ -0,0 +1,145 @@
+// Pointer input sources beneath the main loop
+
+use std::time::Instant;
+use crate::layout::Layout;
+use crate::layout::Zones;
+use crate::spawn::Builtin;
+use crate::stats::Stats;
+
+// Receives what a backend reports
+pub trait Sink {
+	// The monitor setup changed, all edge state is stale
+	fn layout(&mut self, layout: &Layout);
+
+	// The pointer is at a new position, moved by the raw delta. Deltas
+	// go on while the pointer is clamped at an edge, 0 if unknown.
+	fn motion(&mut self, layout: &Layout, x: i32, y: i32, delta: (f64, f64));
+
+	fn stats(&mut self) -> &mut Stats;
+
+	// Pointer events are off while a fullscreen window is in front
+	fn suspended(&mut self, _suspended: bool)
+	{
+	}
+}
+
+pub trait Backend {
+	// Descriptor the main loop polls, readable when there is input
+	fn fd(&self) -> i32;
+
+	// Handles all pending input without blocking
+	fn dispatch(&mut self, sink: &mut dyn Sink);
+
+	// When dispatch must run again without input, e.g. to sample
+	fn deadline(&self) -> Option<Instant>
+	{
+		return None;
+	}
+
+	// Input was read ahead by a round trip after dispatch, e.g. of a
+	// builtin, the fd won't report it again
+	fn pending(&self) -> bool
+	{
+		return false;
+	}
+
+	// Resizes the hot zones of the layout, now and after monitor changes
+	fn set_zones(&mut self, zones: &Zones);
+
+	// Runs a builtin action over the display connection
+	fn builtin(&mut self, _builtin: &Builtin) -> Result<(), String>
+	{
+		return Err("not supported by this backend".to_string());
+	}
+}
+
+// Resync tracked positions with the server after this many events
+const RESYNC_EVENTS: u32 = 500;
+
+// Distance to the monitor bounds at which tracked positions get resynced
+const RESYNC_MARGIN: f64 = 8.0;
+
+// Pointer position estimated from raw motion deltas
+pub struct Tracker {
+	pub x: f64,
+	pub y: f64,
+	events: u32,
+	pub synced: bool,
+}
+
+impl Tracker {
+	pub fn new() -> Tracker
+	{
+		return Tracker { x: 0.0, y: 0.0, events: 0, synced: false };
+	}
+
+	pub fn sync(&mut self, x: i32, y: i32)
+	{
+		self.x = x as f64;
+		self.y = y as f64;
+		self.events = 0;
+		self.synced = true;
+	}
+
+	// Applies a delta, returns false if the estimate must be resynced
+	pub fn motion(&mut self, dx: f64, dy: f64, layout: &Layout) -> bool
+	{
+		self.x += dx;
+		self.y += dy;
+		self.events += 1;
+
+		if !self.synced || self.events >= RESYNC_EVENTS {
+			return false;
+		}
+
+		let rect = match layout.find(self.x as i32, self.y as i32) {
+			Some(i) => layout.monitors[i].rect,
+			None => return false,
+		};
+
+		// Edge hits are only ever decided on real positions
+		let (rx, ry, rw, rh) = (rect.x as f64, rect.y as f64, rect.w as f64, rect.h as f64);
+
+		return self.x - rx >= RESYNC_MARGIN && rx + rw - 1.0 - self.x >= RESYNC_MARGIN &&
+		       self.y - ry >= RESYNC_MARGIN && ry + rh - 1.0 - self.y >= RESYNC_MARGIN;
+	}
+}
+
+// Raw motions drained in one go. Only the newest position is looked at,
+// with the deltas summed up, so a backlog costs a single query and a
+// single detection pass. Zones crossed within the batch are still found
+// on the segment from the previous position.
+#[derive(Debug)]
+pub struct Batch {
+	delta: (f64, f64),
+	query: bool,
+	pending: bool,
+}
+
+impl Batch {
+	pub fn new() -> Batch
+	{
+		return Batch { delta: (0.0, 0.0), query: false, pending: false };
+	}
+
+	// Adds a motion, tracked if its position was estimated
+	pub fn add(&mut self, dx: f64, dy: f64, tracked: bool)
+	{
+		self.delta = (self.delta.0 + dx, self.delta.1 + dy);
+		self.query |= !tracked;
+		self.pending = true;
+	}
+
+	// Returns the summed delta and whether the position must be queried
+	pub fn take(&mut self) -> Option<((f64, f64), bool)>
+	{
+		if !self.pending {
+			return None;
+		}
+
+		let batch = (self.delta, self.query);
+		*self = Batch::new();
+
+		return Some(batch);
+	}
+}
@@ -0,0 +1,485 @@
+// Loading and watching of the config file
+
+use std::ffi::CString;
+use std::fs::File;
+use std::io::BufRead;
+use std::io::BufReader;
+use std::path::PathBuf;
+use crate::layout::Span;
+use crate::layout::Zones;
+use crate::layout::EDGES;
+use crate::spawn::Action;
+use crate::spawn::Table;
+
+const FILE_NAME: &str = "edges.conf";
+
+#[derive(Debug, Clone)]
+pub struct Config {
+	pub commands: [Option<String>; 8],
+	pub dwell: u64,
+	pub rearm: i32,
+	pub push: u32,
+	pub max_velocity: u32,
+	pub exclusive: [bool; 8],
+	pub cooldown: [u64; 8],
+	pub coalesce: [bool; 8],
+	pub zones: Zones,
+
+	// Commands of [monitor:NAME] sections, names are lowercase
+	pub monitors: Vec<(String, [Option<Option<String>>; 8])>,
+}
+
+// Settings from the command line, they win over the file
+#[derive(Debug, Clone, Default)]
+pub struct Overrides {
+	pub commands: [Option<String>; 8],
+	pub dwell: Option<u64>,
+	pub rearm: Option<i32>,
+	pub push: Option<u32>,
+	pub max_velocity: Option<u32>,
+	pub exclusive: bool,
+	pub cooldown: Option<u64>,
+	pub coalesce: bool,
+	pub corner: Option<i32>,
+	pub span: Option<Span>,
+}
+
+pub fn path() -> PathBuf
+{
+	let mut path = dirs::config_dir().unwrap();
+	path.push(FILE_NAME);
+
+	return path;
+}
+
+// Cuts off a comment, ; or # at the start of the line or after
+// whitespace, outside of quotes, so commands keep them otherwise
+fn strip_comment(line: &str) -> &str
+{
+	let mut quote = None;
+	let mut escaped = false;
+	let mut space = true;
+
+	for (i, c) in line.char_indices() {
+		let literal = escaped;
+		match (quote, c) {
+			_ if literal => escaped = false,
+			(Some('\''), '\'') => quote = None,
+			(Some('\''), _) => {}
+			(_, '\\') => escaped = true,
+			(Some('"'), '"') => quote = None,
+			(Some(_), _) => {}
+			(None, '\'' | '"') => quote = Some(c),
+			(None, ';' | '#') if space => return &line[..i],
+			_ => {}
+		}
+		space = quote.is_none() && !literal && c.is_whitespace();
+	}
+
+	return line;
+}
+
+// Reads an INI file line by line and calls back with the lowercase
+// section and key of each value, nothing is kept around. Comments start
+// with ; or # at the start of a line or after whitespace outside quotes,
+// empty values are None.
+fn parse(reader: impl BufRead, mut f: impl FnMut(&str, &str, Option<&str>) -> Result<(), String>) -> Result<(), String>
+{
+	let mut section = String::from("default");
+
+	for (n, line) in reader.lines().enumerate() {
+		let line = line.map_err(|e| e.to_string())?;
+		let line = strip_comment(&line).trim();
+
+		if line.is_empty() {
+			continue;
+		}
+
+		if let Some(name) = line.strip_prefix('[') {
+			let name = name.strip_suffix(']').ok_or(format!("line {}: missing ]", n + 1))?;
+			section = name.trim().to_lowercase();
+			continue;
+		}
+
+		let (key, value) = match line.find(|c| c == '=' || c == ':') {
+			Some(i) => (&line[..i], line[i + 1..].trim()),
+			None => (line, ""),
+		};
+		let value = if value.is_empty() { None } else { Some(value) };
+
+		f(&section, &key.trim().to_lowercase(), value).map_err(|e| format!("line {}: {}", n + 1, e))?;
+	}
+
+	return Ok(());
+}
+
+fn number<T: std::str::FromStr>(key: &str, value: Option<&str>) -> Result<Option<T>, String>
+{
+	return match value {
+		Some(v) => v.parse().map(Some).map_err(|_| format!("{}: invalid number {}", key, v)),
+		None => Ok(None),
+	};
+}
+
+fn boolean(key: &str, value: Option<&str>) -> Result<Option<bool>, String>
+{
+	return match value.map(|v| v.to_lowercase()).as_deref() {
+		Some("true" | "yes" | "on" | "1") => Ok(Some(true)),
+		Some("false" | "no" | "off" | "0") => Ok(Some(false)),
+		Some(v) => Err(format!("{}: invalid boolean {}", key, v)),
+		None => Ok(None),
+	};
+}
+
+fn edge_index(name: &str) -> Option<usize>
+{
+	return EDGES.iter().position(|edge| edge.name() == name);
+}
+
+impl Config {
+	pub fn new() -> Config
+	{
+		return Config {
+			commands: Default::default(),
+			dwell: 0,
+			rearm: 1,
+			push: 0,
+			max_velocity: 0,
+			exclusive: [false; 8],
+			cooldown: [0; 8],
+			coalesce: [false; 8],
+			zones: Zones::new(),
+			monitors: Vec::new(),
+		};
+	}
+
+	// Builds the settings from the config file if asked to, then the
+	// command line on top
+	pub fn load(overrides: &Overrides, file: bool) -> Result<Config, String>
+	{
+		let mut config = Config::new();
+
+		if file {
+			let path = path();
+			let reader = File::open(&path).map(BufReader::new).map_err(|e| format!("{}: {}", path.display(), e))?;
+			config.read(reader)?;
+		}
+
+		for edge in EDGES {
+			if let Some(cmd) = &overrides.commands[edge as usize] {
+				config.commands[edge as usize] = Some(cmd.clone());
+			}
+		}
+		config.dwell = overrides.dwell.unwrap_or(config.dwell);
+		config.rearm = overrides.rearm.unwrap_or(config.rearm);
+		config.push = overrides.push.unwrap_or(config.push);
+		config.max_velocity = overrides.max_velocity.unwrap_or(config.max_velocity);
+		for edge in EDGES {
+			let i = edge as usize;
+			config.exclusive[i] |= overrides.exclusive;
+			config.cooldown[i] = overrides.cooldown.unwrap_or(config.cooldown[i]);
+			config.coalesce[i] |= overrides.coalesce;
+			config.zones.corner[i] = overrides.corner.unwrap_or(config.zones.corner[i]);
+			config.zones.span[i] = overrides.span.unwrap_or(config.zones.span[i]);
+		}
+
+		return Ok(config);
+	}
+
+	fn read(&mut self, reader: impl BufRead) -> Result<(), String>
+	{
+		// Per edge options, the last one is from [Options]. Sections of
+		// single edges win wherever they come in the file.
+		let mut exclusive: [Option<bool>; 9] = [None; 9];
+		let mut cooldown: [Option<u64>; 9] = [None; 9];
+		let mut coalesce: [Option<bool>; 9] = [None; 9];
+		let mut corner: [Option<i32>; 9] = [None; 9];
+		let mut span: [Option<Span>; 9] = [None; 9];
+
+		parse(reader, |section, key, value| {
+			if section == "commands" {
+				if let Some(i) = edge_index(key) {
+					self.commands[i] = value.map(|v| v.to_string());
+				}
+				return Ok(());
+			}
+
+			// Per monitor sections override single commands, an empty one
+			// disables the edge on that monitor
+			if let Some(name) = section.strip_prefix("monitor:") {
+				if let Some(i) = edge_index(key) {
+					let k = match self.monitors.iter().position(|(n, _)| n == name) {
+						Some(k) => k,
+						None => {
+							self.monitors.push((name.to_string(), Default::default()));
+							self.monitors.len() - 1
+						}
+					};
+					self.monitors[k].1[i] = Some(value.map(|v| v.to_string()));
+				}
+				return Ok(());
+			}
+
+			let i = match section.strip_prefix("edge:") {
+				Some(name) => match edge_index(name) {
+					Some(i) => i,
+					None => return Ok(()),
+				},
+				None if section == "options" => 8,
+				None => return Ok(()),
+			};
+
+			match key {
+				"dwell" if i == 8 => self.dwell = number(key, value)?.unwrap_or(self.dwell),
+				"rearm" if i == 8 => self.rearm = number(key, value)?.unwrap_or(self.rearm),
+				"push" if i == 8 => self.push = number(key, value)?.unwrap_or(self.push),
+				"max_velocity" if i == 8 => self.max_velocity = number(key, value)?.unwrap_or(self.max_velocity),
+				"exclusive" => exclusive[i] = boolean(key, value)?.or(exclusive[i]),
+				"cooldown" => cooldown[i] = number(key, value)?.or(cooldown[i]),
+				"coalesce" => coalesce[i] = boolean(key, value)?.or(coalesce[i]),
+				"corner" => corner[i] = number(key, value)?.or(corner[i]),
+				"span" => span[i] = value.map(Span::parse).transpose()?.or(span[i]),
+				_ => {}
+			}
+
+			return Ok(());
+		})?;
+
+		for i in 0..8 {
+			self.exclusive[i] = exclusive[i].or(exclusive[8]).unwrap_or(self.exclusive[i]);
+			self.cooldown[i] = cooldown[i].or(cooldown[8]).unwrap_or(self.cooldown[i]);
+			self.coalesce[i] = coalesce[i].or(coalesce[8]).unwrap_or(self.coalesce[i]);
+			self.zones.corner[i] = corner[i].or(corner[8]).unwrap_or(self.zones.corner[i]);
+			self.zones.span[i] = span[i].or(span[8]).unwrap_or(self.zones.span[i]);
+		}
+
+		return Ok(());
+	}
+
+	// Builds the command table for monitors with these names, one row per
+	// monitor, or a single row without [monitor:NAME] sections. Launching
+	// needs no allocations or lookups then.
+	pub fn actions(&self, names: &[String]) -> Result<Table, String>
+	{
+		let mut row: [Option<Action>; 8] = Default::default();
+
+		for edge in EDGES {
+			if let Some(cmd) = &self.commands[edge as usize] {
+				row[edge as usize] = Action::parse(cmd)?;
+			}
+		}
+
+		// Sections of absent monitors are checked too
+		let mut overrides = Vec::with_capacity(self.monitors.len());
+		for (name, commands) in &self.monitors {
+			let mut actions: [Option<Option<Action>>; 8] = Default::default();
+			for edge in EDGES {
+				if let Some(cmd) = &commands[edge as usize] {
+					actions[edge as usize] = Some(match cmd {
+						Some(cmd) => Action::parse(cmd)?,
+						None => None,
+					});
+				}
+			}
+			overrides.push((name, actions));
+		}
+
+		if overrides.is_empty() || names.is_empty() {
+			return Ok(vec![row]);
+		}
+
+		let mut table = Vec::with_capacity(names.len());
+		for name in names {
+			let mut actions = row.clone();
+			if let Some((_, o)) = overrides.iter().find(|(n, _)| n.eq_ignore_ascii_case(name)) {
+				for edge in EDGES {
+					if let Some(action) = &o[edge as usize] {
+						actions[edge as usize] = action.clone();
+					}
+				}
+			}
+			table.push(actions);
+		}
+
+		return Ok(table);
+	}
+}
+
+// Watches the config file with inotify
+pub struct Watch {
+	fd: i32,
+}
+
+impl Watch {
+	pub fn new() -> Option<Watch>
+	{
+		let path = path();
+		let dir = CString::new(path.parent()?.to_str()?).ok()?;
+
+		unsafe {
+			let fd = libc::inotify_init1(libc::IN_NONBLOCK | libc::IN_CLOEXEC);
+			if fd < 0 {
+				return None;
+			}
+
+			// Editors often replace the file, so watch the directory
+			if libc::inotify_add_watch(fd, dir.as_ptr(), libc::IN_CLOSE_WRITE | libc::IN_MOVED_TO) < 0 {
+				libc::close(fd);
+				return None;
+			}
+
+			return Some(Watch { fd });
+		}
+	}
+
+	pub fn fd(&self) -> i32
+	{
+		return self.fd;
+	}
+
+	// Reads all pending events, returns true if the config file changed
+	pub fn changed(&self) -> bool
+	{
+		let mut changed = false;
+		let mut buf = [0u8; 4096];
+		let header = std::mem::size_of::<libc::inotify_event>();
+
+		loop {
+			let n = unsafe { libc::read(self.fd, buf.as_mut_ptr() as *mut libc::c_void, buf.len()) };
+			if n <= 0 {
+				break;
+			}
+
+			let mut i = 0;
+			while i + header <= n as usize {
+				let event = unsafe { std::ptr::read_unaligned(buf.as_ptr().add(i) as *const libc::inotify_event) };
+				let name = &buf[i + header..i + header + event.len as usize];
+				let name = name.split(|&b| b == 0).next().unwrap_or(&[]);
+
+				if name == FILE_NAME.as_bytes() {
+					changed = true;
+				}
+				i += header + event.len as usize;
+			}
+		}
+
+		return changed;
+	}
+}
+
+impl Drop for Watch {
+	fn drop(&mut self)
+	{
+		unsafe {
+			libc::close(self.fd);
+		}
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+	use crate::layout::Edge;
+	use crate::spawn::Builtin;
+
+	const FILE: &str = "
+; comment
+[Commands]
+TopLeft = /bin/true # trailing comment
+right: > /tmp/edges-fifo hi
+bottom =
+
+[edge:topleft]
+cooldown = 500
+corner = 8
+
+[Options]
+dwell = 100
+cooldown = 50
+exclusive = yes
+span = 30%
+
+[monitor:HDMI-1]
+topleft =
+right = @showdesktop
+";
+
+	fn read(text: &str) -> Result<Config, String>
+	{
+		let mut config = Config::new();
+		config.read(text.as_bytes())?;
+
+		return Ok(config);
+	}
+
+	#[test]
+	fn parse_values()
+	{
+		let mut values = Vec::new();
+		parse("[A b]\n# x\nKey = v ; c\nflag\nempty =\n".as_bytes(), |section, key, value| {
+			values.push((section.to_string(), key.to_string(), value.map(|v| v.to_string())));
+			return Ok(());
+		}).unwrap();
+
+		assert_eq!(values, [
+			("a b".to_string(), "key".to_string(), Some("v".to_string())),
+			("a b".to_string(), "flag".to_string(), None),
+			("a b".to_string(), "empty".to_string(), None),
+		]);
+		assert_eq!(parse("\n[open\n".as_bytes(), |_, _, _| Ok(())), Err("line 2: missing ]".to_string()));
+	}
+
+	#[test]
+	fn comments_outside_quotes()
+	{
+		assert_eq!(strip_comment("; all"), "");
+		assert_eq!(strip_comment("top = a ; b"), "top = a ");
+		assert_eq!(strip_comment("top = a\t# b"), "top = a\t");
+		assert_eq!(strip_comment("top = sh -c 'a; b'"), "top = sh -c 'a; b'");
+		assert_eq!(strip_comment("top = xdg-open 'https://host/#x' # site"), "top = xdg-open 'https://host/#x' ");
+		assert_eq!(strip_comment("top = xdg-open https://host/#x"), "top = xdg-open https://host/#x");
+		assert_eq!(strip_comment("top = echo \"it's\" \\# a # b"), "top = echo \"it's\" \\# a ");
+		assert_eq!(strip_comment("top = echo \"a \\\" ;b\""), "top = echo \"a \\\" ;b\"");
+		assert_eq!(strip_comment("top = echo a\\ ;b"), "top = echo a\\ ;b");
+
+		let config = read("[Commands]\ntop = sh -c 'a; b' ; both\n").unwrap();
+		assert_eq!(config.commands[Edge::TOP as usize].as_deref(), Some("sh -c 'a; b'"));
+	}
+
+	#[test]
+	fn edge_sections_win()
+	{
+		let config = read(FILE).unwrap();
+		let (topleft, right) = (Edge::TOPLEFT as usize, Edge::RIGHT as usize);
+
+		assert_eq!(config.commands[topleft].as_deref(), Some("/bin/true"));
+		assert_eq!(config.commands[right].as_deref(), Some("> /tmp/edges-fifo hi"));
+		assert_eq!(config.commands[Edge::BOTTOM as usize], None);
+		assert_eq!(config.dwell, 100);
+		assert_eq!((config.cooldown[topleft], config.cooldown[right]), (500, 50));
+		assert_eq!((config.zones.corner[topleft], config.zones.corner[right]), (8, 1));
+		assert_eq!(config.zones.span[right], Span::FRACTION(0.3));
+		assert!(config.exclusive.iter().all(|&e| e));
+
+		assert!(read("[Options]\ndwell = soon\n").unwrap_err().starts_with("line 2: dwell"));
+		assert!(read("[edge:top]\ncoalesce = maybe\n").is_err());
+	}
+
+	#[test]
+	fn monitor_rows()
+	{
+		let config = read(FILE).unwrap();
+		let (topleft, right) = (Edge::TOPLEFT as usize, Edge::RIGHT as usize);
+
+		assert_eq!(config.actions(&[]).unwrap().len(), 1);
+
+		let table = config.actions(&["DP-1".to_string(), "hdmi-1".to_string()]).unwrap();
+		assert_eq!(table.len(), 2);
+		assert!(matches!(table[0][topleft], Some(Action::Exec { .. })));
+		assert!(matches!(table[0][right], Some(Action::Send { .. })));
+		assert!(table[1][topleft].is_none());
+		assert!(matches!(table[1][right], Some(Action::Builtin(Builtin::SHOWDESKTOP))));
+
+		assert!(read("[monitor:x]\ntop = 'open\n").unwrap().actions(&[]).is_err());
+	}
+}
@@ -0,0 +1,249 @@
+// Single instance control socket
+//
+// The daemon binds an abstract Unix socket named after the user and the
+// display, so a second instance fails to start. Other processes send one
+// request line per connection and read the reply until it is closed.
+
+use std::env;
+use std::io::Read;
+use std::io::Write;
+use std::os::linux::net::SocketAddrExt;
+use std::os::unix::io::AsRawFd;
+use std::os::unix::net::SocketAddr;
+use std::os::unix::net::UnixListener;
+use std::os::unix::net::UnixStream;
+use std::time::Duration;
+
+// Replies are small, a client that doesn't read them is dropped
+const TIMEOUT: Duration = Duration::from_millis(100);
+
+const MAX_REQUEST: usize = 4096;
+
+// Connections whose request isn't complete yet, the oldest is dropped
+const MAX_PENDING: usize = 16;
+
+// X display names as HOST:DISPLAY, the screen doesn't matter and unix
+// is the local host. Wayland socket names are kept.
+fn normalize(display: &str) -> String
+{
+	let (host, rest) = match display.rfind(':') {
+		Some(i) => display.split_at(i),
+		None => return display.to_string(),
+	};
+	let number = rest[1..].split('.').next().unwrap_or("");
+
+	return format!("{}:{}", if host == "unix" { "" } else { host }, number);
+}
+
+// The socket of the given display, or the one of the environment
+fn address(display: Option<&str>) -> Result<SocketAddr, String>
+{
+	let display = match display {
+		Some(display) => display.to_string(),
+		None => env::var("WAYLAND_DISPLAY").or_else(|_| env::var("DISPLAY")).unwrap_or_default(),
+	};
+	let name = format!("edges-{}-{}", unsafe { libc::getuid() }, normalize(&display));
+
+	return SocketAddr::from_abstract_name(name.as_bytes()).map_err(|e| e.to_string());
+}
+
+// Abstract sockets have no permissions, only the same user may connect
+fn same_user(stream: &UnixStream) -> bool
+{
+	let mut cred = libc::ucred { pid: 0, uid: u32::MAX, gid: 0 };
+	let mut len = std::mem::size_of::<libc::ucred>() as libc::socklen_t;
+
+	unsafe {
+		if libc::getsockopt(stream.as_raw_fd(), libc::SOL_SOCKET, libc::SO_PEERCRED,
+				    &mut cred as *mut libc::ucred as *mut libc::c_void, &mut len) < 0 {
+			return false;
+		}
+		return cred.uid == libc::getuid();
+	}
+}
+
+// A connection and the part of its request read so far
+struct Pending {
+	stream: UnixStream,
+	request: Vec<u8>,
+}
+
+fn epoll_ctl(epoll: i32, op: i32, fd: i32)
+{
+	let mut event = libc::epoll_event { events: libc::EPOLLIN as u32, u64: fd as u64 };
+
+	unsafe {
+		libc::epoll_ctl(epoll, op, fd, &mut event);
+	}
+}
+
+// The listener and the pending connections are watched through one epoll
+// descriptor, the loop never waits for a client
+pub struct Control {
+	listener: UnixListener,
+	epoll: i32,
+	pending: Vec<Pending>,
+}
+
+impl Control {
+	pub fn bind(display: Option<&str>) -> Result<Control, String>
+	{
+		let listener = match UnixListener::bind_addr(&address(display)?) {
+			Ok(listener) => listener,
+			Err(e) if e.kind() == std::io::ErrorKind::AddrInUse => {
+				return Err(match display {
+					Some(display) => format!("edges is already running on {}", display),
+					None => "edges is already running on this display".to_string(),
+				});
+			}
+			Err(e) => return Err(e.to_string()),
+		};
+		listener.set_nonblocking(true).map_err(|e| e.to_string())?;
+
+		let epoll = unsafe { libc::epoll_create1(libc::EPOLL_CLOEXEC) };
+		if epoll < 0 {
+			return Err(std::io::Error::last_os_error().to_string());
+		}
+		epoll_ctl(epoll, libc::EPOLL_CTL_ADD, listener.as_raw_fd());
+
+		return Ok(Control { listener, epoll, pending: Vec::new() });
+	}
+
+	// Readable when a client connected or sent more of its request
+	pub fn fd(&self) -> i32
+	{
+		return self.epoll;
+	}
+
+	// Accepts waiting clients and reads what they sent, returns the next
+	// complete request. It is complete once the client shut down writing.
+	pub fn accept(&mut self) -> Option<(UnixStream, String)>
+	{
+		while let Ok((stream, _)) = self.listener.accept() {
+			if !same_user(&stream) || stream.set_nonblocking(true).is_err() {
+				continue;
+			}
+			if self.pending.len() == MAX_PENDING {
+				self.drop_pending(0);
+			}
+			epoll_ctl(self.epoll, libc::EPOLL_CTL_ADD, stream.as_raw_fd());
+			self.pending.push(Pending { stream, request: Vec::new() });
+		}
+
+		let mut i = 0;
+		while i < self.pending.len() {
+			let p = &mut self.pending[i];
+			let mut buf = [0u8; 512];
+
+			let done = loop {
+				match (&p.stream).read(&mut buf) {
+					Ok(0) => break Some(true),
+					Ok(n) if p.request.len() + n <= MAX_REQUEST => p.request.extend_from_slice(&buf[..n]),
+					Err(e) if e.kind() == std::io::ErrorKind::WouldBlock => break None,
+					Err(e) if e.kind() == std::io::ErrorKind::Interrupted => {}
+					_ => break Some(false),
+				}
+			};
+
+			match done {
+				None => i += 1,
+				Some(false) => { self.drop_pending(i); }
+				Some(true) => {
+					let p = self.drop_pending(i);
+					if p.stream.set_nonblocking(false).is_err() ||
+					   p.stream.set_write_timeout(Some(TIMEOUT)).is_err() {
+						continue;
+					}
+					let request = String::from_utf8_lossy(&p.request).trim().to_string();
+					return Some((p.stream, request));
+				}
+			}
+		}
+
+		return None;
+	}
+
+	fn drop_pending(&mut self, i: usize) -> Pending
+	{
+		let p = self.pending.remove(i);
+		epoll_ctl(self.epoll, libc::EPOLL_CTL_DEL, p.stream.as_raw_fd());
+
+		return p;
+	}
+}
+
+impl Drop for Control {
+	fn drop(&mut self)
+	{
+		unsafe {
+			libc::close(self.epoll);
+		}
+	}
+}
+
+// Sends a request to the instance running on the display, returns the reply
+pub fn send(request: &str, display: Option<&str>) -> Result<String, String>
+{
+	let mut stream = UnixStream::connect_addr(&address(display)?).map_err(|_| match display {
+		Some(display) => format!("edges is not running on {}", display),
+		None => "edges is not running".to_string(),
+	})?;
+
+	stream.write_all(request.as_bytes()).map_err(|e| e.to_string())?;
+	stream.shutdown(std::net::Shutdown::Write).map_err(|e| e.to_string())?;
+
+	let mut reply = String::new();
+	stream.read_to_string(&mut reply).map_err(|e| e.to_string())?;
+
+	return Ok(reply);
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+	use std::time::Instant;
+
+	#[test]
+	fn display_names()
+	{
+		assert_eq!(normalize(":1"), ":1");
+		assert_eq!(normalize(":1.0"), ":1");
+		assert_eq!(normalize("unix:1.2"), ":1");
+		assert_eq!(normalize("host:0.1"), "host:0");
+		assert_eq!(normalize("wayland-0"), "wayland-0");
+	}
+
+	#[test]
+	fn silent_clients_do_not_block()
+	{
+		let display = format!("test-{}", std::process::id());
+		let mut control = Control::bind(Some(&display)).unwrap();
+
+		let silent = UnixStream::connect_addr(&address(Some(&display)).unwrap()).unwrap();
+		let start = Instant::now();
+		assert!(control.accept().is_none());
+		assert!(start.elapsed() < Duration::from_millis(50));
+
+		let mut client = UnixStream::connect_addr(&address(Some(&display)).unwrap()).unwrap();
+		client.write_all(b"status\n").unwrap();
+		client.shutdown(std::net::Shutdown::Write).unwrap();
+
+		let mut got = None;
+		for _ in 0..100 {
+			got = control.accept();
+			if got.is_some() {
+				break;
+			}
+			std::thread::sleep(Duration::from_millis(5));
+		}
+		let (mut stream, request) = got.unwrap();
+		assert_eq!(request, "status");
+		stream.write_all(b"ok\n").unwrap();
+		drop(stream);
+
+		let mut reply = String::new();
+		client.read_to_string(&mut reply).unwrap();
+		assert_eq!(reply, "ok\n");
+		drop(silent);
+	}
+}
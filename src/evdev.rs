@@ -0,0 +1,488 @@
+// Evdev backend for Wayland, where the pointer position can't be queried
+//
+// Relative motion of mice and touchpads is read from /dev/input and
+// integrated into a position that is confined to the monitors like the
+// compositor confines the real pointer. The estimate drifts by pointer
+// acceleration, but pushing into an edge or corner clamps it back, which
+// is exactly when it matters. Reading the devices needs the input group.
+
+use std::ffi::CString;
+use std::fs;
+use std::path::Path;
+use std::path::PathBuf;
+use crate::backend::Backend;
+use crate::backend::Sink;
+use crate::layout::Layout;
+use crate::layout::Rect;
+use crate::layout::Zones;
+
+const INPUT_DIR: &str = "/dev/input";
+
+const EV_SYN: u16 = 0x00;
+const EV_KEY: u16 = 0x01;
+const EV_REL: u16 = 0x02;
+const EV_ABS: u16 = 0x03;
+const SYN_REPORT: u16 = 0x00;
+const SYN_DROPPED: u16 = 0x03;
+const REL_X: u16 = 0x00;
+const REL_Y: u16 = 0x01;
+const ABS_X: u16 = 0x00;
+const ABS_Y: u16 = 0x01;
+const BTN_TOUCH: u16 = 0x14a;
+const INPUT_PROP_POINTER: usize = 0x00;
+
+// Touchpad travel is scaled like a 1000 dpi mouse, as libinput does
+const TOUCHPAD_DPI: f64 = 1000.0;
+
+// epoll data of the inotify descriptor, devices use their fd
+const HOTPLUG: u64 = u64::MAX;
+
+fn ioc_read(nr: u64, size: usize) -> u64
+{
+	return (2 << 30) | ((size as u64) << 16) | ((b'E' as u64) << 8) | nr;
+}
+
+// Reads a capability bitmask of the device
+fn bits(fd: i32, request: u64) -> [u8; 64]
+{
+	let mut buf = [0u8; 64];
+
+	unsafe {
+		if libc::ioctl(fd, request as _, buf.as_mut_ptr()) < 0 {
+			return [0u8; 64];
+		}
+	}
+
+	return buf;
+}
+
+fn has(bits: &[u8; 64], bit: usize) -> bool
+{
+	return bits[bit / 8] & (1 << (bit % 8)) != 0;
+}
+
+#[derive(Debug)]
+enum Kind {
+	MOUSE,
+	// Absolute finger positions, moved by the delta between reports
+	TOUCHPAD { scale: (f64, f64), cur: (i32, i32), last: Option<(i32, i32)>, touching: bool },
+}
+
+#[derive(Debug)]
+struct Device {
+	fd: i32,
+	path: PathBuf,
+	kind: Kind,
+	delta: (f64, f64),
+	// The kernel buffer overflowed, events up to the next report are
+	// incomplete
+	dropped: bool,
+}
+
+impl Device {
+	// Opens the device if it moves the pointer
+	fn open(path: &Path) -> Option<Device>
+	{
+		let c_path = CString::new(path.to_str()?).ok()?;
+		let fd = unsafe { libc::open(c_path.as_ptr(), libc::O_RDONLY | libc::O_NONBLOCK | libc::O_CLOEXEC) };
+		if fd < 0 {
+			return None;
+		}
+
+		let ev = bits(fd, ioc_read(0x20, 64));
+		let rel = bits(fd, ioc_read(0x20 + EV_REL as u64, 64));
+		let abs = bits(fd, ioc_read(0x20 + EV_ABS as u64, 64));
+		let key = bits(fd, ioc_read(0x20 + EV_KEY as u64, 64));
+		let prop = bits(fd, ioc_read(0x09, 64));
+
+		let kind = if has(&ev, EV_REL as usize) && has(&rel, REL_X as usize) && has(&rel, REL_Y as usize) {
+			Kind::MOUSE
+		} else if has(&ev, EV_ABS as usize) && has(&abs, ABS_X as usize) && has(&abs, ABS_Y as usize) &&
+			  has(&key, BTN_TOUCH as usize) && has(&prop, INPUT_PROP_POINTER) {
+			// Touchscreens lack the pointer property and are left alone
+			let sx = absinfo(fd, ABS_X).map_or(1.0, |i| scale(&i));
+			let sy = absinfo(fd, ABS_Y).map_or(1.0, |i| scale(&i));
+			Kind::TOUCHPAD { scale: (sx, sy), cur: (0, 0), last: None, touching: false }
+		} else {
+			unsafe {
+				libc::close(fd);
+			}
+			return None;
+		};
+
+		return Some(Device { fd, path: path.to_path_buf(), kind, delta: (0.0, 0.0), dropped: false });
+	}
+
+	// Handles one event, returns the motion of a complete report
+	fn event(&mut self, ev: &libc::input_event) -> Option<(f64, f64)>
+	{
+		if (ev.type_, ev.code) == (EV_SYN, SYN_DROPPED) {
+			self.dropped = true;
+		}
+		if self.dropped {
+			// Touchpads start over from the first complete report
+			self.delta = (0.0, 0.0);
+			if let Kind::TOUCHPAD { last, .. } = &mut self.kind {
+				*last = None;
+			}
+			self.dropped = (ev.type_, ev.code) != (EV_SYN, SYN_REPORT);
+			return None;
+		}
+
+		match (&mut self.kind, ev.type_, ev.code) {
+			(Kind::MOUSE, EV_REL, REL_X) => self.delta.0 += ev.value as f64,
+			(Kind::MOUSE, EV_REL, REL_Y) => self.delta.1 += ev.value as f64,
+			(Kind::TOUCHPAD { cur, .. }, EV_ABS, ABS_X) => cur.0 = ev.value,
+			(Kind::TOUCHPAD { cur, .. }, EV_ABS, ABS_Y) => cur.1 = ev.value,
+			(Kind::TOUCHPAD { last, touching, .. }, EV_KEY, BTN_TOUCH) => {
+				*touching = ev.value != 0;
+				*last = None;
+			}
+			(_, EV_SYN, SYN_REPORT) => {
+				if let Kind::TOUCHPAD { scale, cur, last, touching } = &mut self.kind {
+					if *touching {
+						if let Some(l) = last {
+							self.delta.0 += (cur.0 - l.0) as f64 * scale.0;
+							self.delta.1 += (cur.1 - l.1) as f64 * scale.1;
+						}
+						*last = Some(*cur);
+					}
+				}
+
+				let delta = std::mem::replace(&mut self.delta, (0.0, 0.0));
+				if delta != (0.0, 0.0) {
+					return Some(delta);
+				}
+			}
+			_ => {}
+		}
+
+		return None;
+	}
+}
+
+impl Drop for Device {
+	fn drop(&mut self)
+	{
+		unsafe {
+			libc::close(self.fd);
+		}
+	}
+}
+
+fn absinfo(fd: i32, axis: u16) -> Option<libc::input_absinfo>
+{
+	let mut info: libc::input_absinfo = unsafe { std::mem::zeroed() };
+	let request = ioc_read(0x40 + axis as u64, std::mem::size_of::<libc::input_absinfo>());
+
+	unsafe {
+		if libc::ioctl(fd, request as _, &mut info as *mut libc::input_absinfo) < 0 {
+			return None;
+		}
+	}
+
+	return Some(info);
+}
+
+// Pixels per touchpad unit
+fn scale(info: &libc::input_absinfo) -> f64
+{
+	// Without a resolution assume a 100 mm wide pad
+	let units_per_mm = if info.resolution > 0 {
+		info.resolution as f64
+	} else {
+		((info.maximum - info.minimum) as f64 / 100.0).max(1.0)
+	};
+
+	return TOUCHPAD_DPI / 25.4 / units_per_mm;
+}
+
+// Parses "WxH+X+Y" monitors separated by commas
+pub fn parse_geometry(s: &str) -> Result<Vec<Rect>, String>
+{
+	let mut rects = Vec::new();
+
+	for part in s.split(',') {
+		let err = || format!("invalid geometry: {}", part);
+		let num = |v: &str| v.parse::<i32>().map_err(|_| err());
+
+		let (size, pos) = part.split_once('+').unwrap_or((part, "0+0"));
+		let (w, h) = size.split_once('x').ok_or_else(err)?;
+		let (x, y) = pos.split_once('+').ok_or_else(err)?;
+
+		let rect = Rect { x: num(x)?, y: num(y)?, w: num(w)?, h: num(h)? };
+		if rect.w <= 0 || rect.h <= 0 {
+			return Err(err());
+		}
+		rects.push(rect);
+	}
+
+	return Ok(rects);
+}
+
+// Guesses the monitors from the preferred modes of connected DRM outputs,
+// placed side by side. Scaling and arrangement are only known to the
+// compositor and must be given with --geometry when they differ.
+// Returns the output names too, card0-DP-1 is named DP-1.
+pub fn drm_geometry() -> (Vec<Rect>, Vec<String>)
+{
+	let mut outputs: Vec<PathBuf> = match fs::read_dir("/sys/class/drm") {
+		Ok(dir) => dir.filter_map(|e| e.ok()).map(|e| e.path()).collect(),
+		Err(_) => return (Vec::new(), Vec::new()),
+	};
+	outputs.sort();
+
+	let mut rects = Vec::new();
+	let mut names = Vec::new();
+	let mut x = 0;
+
+	for output in outputs {
+		let status = fs::read_to_string(output.join("status")).unwrap_or_default();
+		if status.trim() != "connected" {
+			continue;
+		}
+
+		let modes = fs::read_to_string(output.join("modes")).unwrap_or_default();
+		let mode = modes.lines().next().unwrap_or("");
+		if let Ok(r) = parse_geometry(mode) {
+			rects.push(Rect { x, y: 0, w: r[0].w, h: r[0].h });
+			x += r[0].w;
+
+			let connector = output.file_name().unwrap_or_default().to_string_lossy();
+			names.push(connector.split_once('-').map_or("", |(_, name)| name).to_string());
+		}
+	}
+
+	return (rects, names);
+}
+
+pub struct Evdev {
+	epoll: i32,
+	inotify: i32,
+	devices: Vec<Device>,
+	layout: Layout,
+	x: f64,
+	y: f64,
+	announce: bool,
+}
+
+impl Evdev {
+	pub fn new(rects: &[Rect], names: Vec<String>) -> Result<Evdev, String>
+	{
+		if rects.is_empty() {
+			return Err("Monitor geometry unknown, use --geometry".to_string());
+		}
+
+		let mut layout = Layout::new(0, 0, rects);
+		layout.set_names(names);
+		let r = layout.monitors[0].rect;
+
+		let mut evdev = unsafe {
+			let epoll = libc::epoll_create1(libc::EPOLL_CLOEXEC);
+			let inotify = libc::inotify_init1(libc::IN_NONBLOCK | libc::IN_CLOEXEC);
+			if epoll < 0 || inotify < 0 {
+				return Err("epoll or inotify failed".to_string());
+			}
+
+			Evdev {
+				epoll,
+				inotify,
+				devices: Vec::new(),
+				layout,
+				x: (r.x + r.w / 2) as f64,
+				y: (r.y + r.h / 2) as f64,
+				announce: true,
+			}
+		};
+
+		// Devices show up later on hotplug, permissions are set by udev after the node
+		let dir = CString::new(INPUT_DIR).unwrap();
+		unsafe {
+			libc::inotify_add_watch(evdev.inotify, dir.as_ptr(), libc::IN_CREATE | libc::IN_ATTRIB);
+		}
+		evdev.add(evdev.inotify, HOTPLUG);
+		evdev.scan();
+
+		if evdev.devices.is_empty() {
+			return Err(format!("No pointer device readable in {}, is the user in the input group?", INPUT_DIR));
+		}
+
+		return Ok(evdev);
+	}
+
+	fn add(&self, fd: i32, data: u64)
+	{
+		let mut event = libc::epoll_event { events: libc::EPOLLIN as u32, u64: data };
+
+		unsafe {
+			libc::epoll_ctl(self.epoll, libc::EPOLL_CTL_ADD, fd, &mut event);
+		}
+	}
+
+	// Opens pointer devices that are not open yet
+	fn scan(&mut self)
+	{
+		let entries = match fs::read_dir(INPUT_DIR) {
+			Ok(dir) => dir,
+			Err(_) => return,
+		};
+
+		for entry in entries.filter_map(|e| e.ok()) {
+			let path = entry.path();
+			let name = entry.file_name();
+			if !name.to_string_lossy().starts_with("event") || self.devices.iter().any(|d| d.path == path) {
+				continue;
+			}
+
+			if let Some(device) = Device::open(&path) {
+				self.add(device.fd, device.fd as u64);
+				self.devices.push(device);
+			}
+		}
+	}
+
+	// Moves the estimate, confined to the monitors
+	fn motion(&mut self, dx: f64, dy: f64, sink: &mut dyn Sink)
+	{
+		let (mut x, mut y) = (self.x + dx, self.y + dy);
+
+		if self.layout.find(x as i32, y as i32).is_none() {
+			let i = self.layout.find(self.x as i32, self.y as i32).unwrap_or(0);
+			let r = self.layout.monitors[i].rect;
+			x = x.clamp(r.x as f64, (r.x + r.w - 1) as f64);
+			y = y.clamp(r.y as f64, (r.y + r.h - 1) as f64);
+		}
+
+		self.x = x;
+		self.y = y;
+
+		sink.motion(&self.layout, x as i32, y as i32, (dx, dy));
+	}
+
+	fn read(&mut self, index: usize, sink: &mut dyn Sink)
+	{
+		let mut events: [libc::input_event; 64] = unsafe { std::mem::zeroed() };
+		let size = std::mem::size_of::<libc::input_event>();
+
+		loop {
+			let fd = self.devices[index].fd;
+			let n = unsafe { libc::read(fd, events.as_mut_ptr() as *mut libc::c_void, size * events.len()) };
+			if n < 0 {
+				match unsafe { *libc::__errno_location() } {
+					libc::EINTR => continue,
+					libc::EAGAIN => return,
+					_ => {}
+				}
+			}
+			if n <= 0 {
+				// Unplugged
+				self.devices.swap_remove(index);
+				return;
+			}
+
+			for ev in &events[..n as usize / size] {
+				if let Some((dx, dy)) = self.devices[index].event(ev) {
+					sink.stats().events += 1;
+					self.motion(dx, dy, sink);
+				}
+			}
+		}
+	}
+}
+
+impl Backend for Evdev {
+	fn fd(&self) -> i32
+	{
+		return self.epoll;
+	}
+
+	// The monitors never change
+	fn set_zones(&mut self, zones: &Zones)
+	{
+		self.layout.set_zones(zones);
+	}
+
+	fn dispatch(&mut self, sink: &mut dyn Sink)
+	{
+		if self.announce {
+			sink.layout(&self.layout);
+			self.announce = false;
+		}
+
+		let mut events = [libc::epoll_event { events: 0, u64: 0 }; 16];
+
+		loop {
+			let n = unsafe { libc::epoll_wait(self.epoll, events.as_mut_ptr(), events.len() as i32, 0) };
+			if n <= 0 {
+				return;
+			}
+
+			for event in &events[..n as usize] {
+				let data = event.u64;
+				if data == HOTPLUG {
+					let mut buf = [0u8; 4096];
+					unsafe {
+						while libc::read(self.inotify, buf.as_mut_ptr() as *mut libc::c_void, buf.len()) > 0 {}
+					}
+					self.scan();
+				} else if let Some(i) = self.devices.iter().position(|d| d.fd as u64 == data) {
+					self.read(i, sink);
+				}
+			}
+		}
+	}
+}
+
+impl Drop for Evdev {
+	fn drop(&mut self)
+	{
+		self.devices.clear();
+
+		unsafe {
+			libc::close(self.inotify);
+			libc::close(self.epoll);
+		}
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	fn event(type_: u16, code: u16, value: i32) -> libc::input_event
+	{
+		let mut ev: libc::input_event = unsafe { std::mem::zeroed() };
+		(ev.type_, ev.code, ev.value) = (type_, code, value);
+
+		return ev;
+	}
+
+	#[test]
+	fn dropped_events_are_skipped()
+	{
+		let mut mouse = Device { fd: -1, path: PathBuf::new(), kind: Kind::MOUSE, delta: (0.0, 0.0), dropped: false };
+		let mut feed = |events: &[(u16, u16, i32)]| {
+			return events.iter().filter_map(|&(t, c, v)| mouse.event(&event(t, c, v))).collect::<Vec<_>>();
+		};
+
+		assert_eq!(feed(&[(EV_REL, REL_X, 3), (EV_REL, REL_Y, -2), (EV_SYN, SYN_REPORT, 0)]), [(3.0, -2.0)]);
+
+		// Everything up to and including the next report is incomplete
+		assert!(feed(&[(EV_REL, REL_X, 5), (EV_SYN, SYN_DROPPED, 0), (EV_REL, REL_X, 7), (EV_SYN, SYN_REPORT, 0)]).is_empty());
+		assert_eq!(feed(&[(EV_REL, REL_X, 1), (EV_SYN, SYN_REPORT, 0)]), [(1.0, 0.0)]);
+	}
+
+	#[test]
+	fn geometry()
+	{
+		assert_eq!(parse_geometry("1920x1080"), Ok(vec![Rect { x: 0, y: 0, w: 1920, h: 1080 }]));
+		assert_eq!(parse_geometry("2560x1440+0+240,1080x1920+2560+0"), Ok(vec![
+			Rect { x: 0, y: 240, w: 2560, h: 1440 },
+			Rect { x: 2560, y: 0, w: 1080, h: 1920 },
+		]));
+
+		for bad in ["", "1920", "1920x", "x1080", "1920x1080+10", "1920x1080+a+0", "0x1080", "1920x-1", "1920x1080,"] {
+			assert_eq!(parse_geometry(bad).err().map(|e| e.starts_with("invalid geometry")), Some(true), "{}", bad);
+		}
+	}
+}
@@ -0,0 +1,291 @@
+// Launching off the event loop thread
+//
+// The loop hands jobs to an executor thread through a lock-free single
+// producer single consumer ring and wakes it with an eventfd. The
+// executor spawns the command and hands the pid or the error back through
+// a second ring along with how long the spawn took. The children are still
+// reaped by the loop on SIGCHLD, by pid, so one that exits before it is
+// reported stays a zombie until then.
+
+use std::cell::UnsafeCell;
+use std::mem::MaybeUninit;
+use std::ptr;
+use std::sync::Arc;
+use std::sync::atomic::AtomicBool;
+use std::sync::atomic::AtomicUsize;
+use std::sync::atomic::Ordering;
+use std::thread::JoinHandle;
+use std::time::Duration;
+use std::time::Instant;
+use crate::spawn::launch;
+use crate::spawn::SpawnAttr;
+use crate::spawn::Table;
+
+const CAPACITY: usize = 64;
+
+// Bounded ring, push must only be called from one thread and pop from
+// one other thread
+pub struct Ring<T> {
+	buf: Box<[UnsafeCell<MaybeUninit<T>>]>,
+	// Next slot to pop, owned by the consumer
+	head: AtomicUsize,
+	// Next slot to push, owned by the producer
+	tail: AtomicUsize,
+}
+
+unsafe impl<T: Send> Sync for Ring<T> {}
+unsafe impl<T: Send> Send for Ring<T> {}
+
+impl<T> Ring<T> {
+	pub fn new(capacity: usize) -> Ring<T>
+	{
+		let buf = (0..capacity.next_power_of_two()).map(|_| UnsafeCell::new(MaybeUninit::uninit())).collect();
+
+		return Ring { buf, head: AtomicUsize::new(0), tail: AtomicUsize::new(0) };
+	}
+
+	// Hands the value back if the ring is full
+	pub fn push(&self, value: T) -> Result<(), T>
+	{
+		let tail = self.tail.load(Ordering::Relaxed);
+		if tail.wrapping_sub(self.head.load(Ordering::Acquire)) == self.buf.len() {
+			return Err(value);
+		}
+
+		unsafe {
+			(*self.buf[tail & (self.buf.len() - 1)].get()).write(value);
+		}
+		self.tail.store(tail.wrapping_add(1), Ordering::Release);
+
+		return Ok(());
+	}
+
+	pub fn pop(&self) -> Option<T>
+	{
+		let head = self.head.load(Ordering::Relaxed);
+		if head == self.tail.load(Ordering::Acquire) {
+			return None;
+		}
+
+		let value = unsafe { (*self.buf[head & (self.buf.len() - 1)].get()).assume_init_read() };
+		self.head.store(head.wrapping_add(1), Ordering::Release);
+
+		return Some(value);
+	}
+}
+
+impl<T> Drop for Ring<T> {
+	fn drop(&mut self)
+	{
+		while self.pop().is_some() {}
+	}
+}
+
+fn eventfd() -> i32
+{
+	let fd = unsafe { libc::eventfd(0, libc::EFD_CLOEXEC) };
+	if fd < 0 {
+		panic!("eventfd failed");
+	}
+
+	return fd;
+}
+
+fn notify(fd: i32)
+{
+	let one: u64 = 1;
+
+	unsafe {
+		libc::write(fd, &one as *const u64 as *const libc::c_void, 8);
+	}
+}
+
+// Commands are looked up in the table the job was queued with, so a
+// reload in between doesn't matter
+type Job = (Arc<Table>, usize);
+
+// The pid if a process is still running, or the errno
+type Launched = Result<Option<libc::pid_t>, i32>;
+
+struct Shared {
+	jobs: Ring<Job>,
+	// Result of the launch, slot and spawn time of every job
+	started: Ring<(Launched, usize, Duration)>,
+	stop: AtomicBool,
+	// Wakes the executor, and the loop once jobs are started
+	wake: i32,
+	done: i32,
+}
+
+pub struct Executor {
+	shared: Arc<Shared>,
+	thread: Option<JoinHandle<()>>,
+}
+
+impl Executor {
+	pub fn new(display: Option<String>) -> Executor
+	{
+		let shared = Arc::new(Shared {
+			jobs: Ring::new(CAPACITY),
+			started: Ring::new(CAPACITY),
+			stop: AtomicBool::new(false),
+			wake: eventfd(),
+			done: eventfd(),
+		});
+		unsafe {
+			libc::fcntl(shared.done, libc::F_SETFL, libc::O_NONBLOCK);
+		}
+
+		let s = shared.clone();
+		let thread = std::thread::spawn(move || {
+			// Signals are handled by the loop thread
+			unsafe {
+				let mut mask = MaybeUninit::<libc::sigset_t>::uninit();
+				libc::sigfillset(mask.as_mut_ptr());
+				libc::pthread_sigmask(libc::SIG_BLOCK, mask.as_ptr(), ptr::null_mut());
+			}
+			executor_loop(&s, display.as_deref());
+		});
+
+		return Executor { shared, thread: Some(thread) };
+	}
+
+	// Readable when started jobs can be collected
+	pub fn fd(&self) -> i32
+	{
+		return self.shared.done;
+	}
+
+	// Hands the job back if the executor is behind
+	pub fn push(&self, table: Arc<Table>, slot: usize) -> Result<(), ()>
+	{
+		self.shared.jobs.push((table, slot)).map_err(|_| ())?;
+		notify(self.shared.wake);
+
+		return Ok(());
+	}
+
+	// Collects the started jobs
+	pub fn started(&self, mut f: impl FnMut(Launched, usize, Duration))
+	{
+		let mut count: u64 = 0;
+		unsafe {
+			libc::read(self.shared.done, &mut count as *mut u64 as *mut libc::c_void, 8);
+		}
+
+		while let Some((launched, slot, time)) = self.shared.started.pop() {
+			f(launched, slot, time);
+		}
+	}
+}
+
+fn executor_loop(shared: &Shared, display: Option<&str>)
+{
+	let attr = SpawnAttr::new(display);
+	let mut count: u64 = 0;
+
+	while !shared.stop.load(Ordering::Acquire) {
+		// Blocks until jobs are queued
+		unsafe {
+			libc::read(shared.wake, &mut count as *mut u64 as *mut libc::c_void, 8);
+		}
+
+		while let Some((table, slot)) = shared.jobs.pop() {
+			let start = Instant::now();
+			let launched = match table.get(slot / 8).and_then(|row| row[slot % 8].as_ref()) {
+				Some(action) => launch(action, &attr),
+				None => Ok(None),
+			};
+
+			// The loop collects jobs faster than it can queue them
+			let mut started = (launched, slot, start.elapsed());
+			while let Err(s) = shared.started.push(started) {
+				started = s;
+				std::thread::yield_now();
+			}
+			notify(shared.done);
+		}
+	}
+}
+
+impl Drop for Executor {
+	fn drop(&mut self)
+	{
+		self.shared.stop.store(true, Ordering::Release);
+		notify(self.shared.wake);
+		if let Some(thread) = self.thread.take() {
+			let _ = thread.join();
+		}
+
+		unsafe {
+			libc::close(self.shared.wake);
+			libc::close(self.shared.done);
+		}
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+	use std::rc::Rc;
+
+	#[test]
+	fn ring_wraps_around()
+	{
+		let ring = Ring::new(3);
+
+		for i in 0..4 {
+			ring.push(i).unwrap();
+		}
+		assert_eq!(ring.push(4), Err(4));
+
+		for i in 4..100 {
+			assert_eq!(ring.pop(), Some(i - 4));
+			ring.push(i).unwrap();
+		}
+		assert_eq!((96..100).map(|_| ring.pop().unwrap()).collect::<Vec<_>>(), [96, 97, 98, 99]);
+		assert_eq!(ring.pop(), None);
+	}
+
+	#[test]
+	fn ring_drops_what_is_left()
+	{
+		let value = Rc::new(());
+		let ring = Ring::new(2);
+		ring.push(value.clone()).unwrap();
+		ring.push(value.clone()).unwrap();
+		assert!(ring.push(value.clone()).is_err());
+		assert_eq!(Rc::strong_count(&value), 3);
+
+		drop(ring);
+		assert_eq!(Rc::strong_count(&value), 1);
+	}
+
+	#[test]
+	fn ring_across_threads()
+	{
+		let ring = Arc::new(Ring::new(CAPACITY));
+		let producer = ring.clone();
+		let thread = std::thread::spawn(move || {
+			for i in 0..10_000u32 {
+				let mut value = i;
+				while let Err(v) = producer.push(value) {
+					value = v;
+					std::thread::yield_now();
+				}
+			}
+		});
+
+		let mut next = 0;
+		while next < 10_000 {
+			match ring.pop() {
+				Some(value) => {
+					assert_eq!(value, next);
+					next += 1;
+				}
+				None => std::thread::yield_now(),
+			}
+		}
+		thread.join().unwrap();
+	}
+}
@@ -0,0 +1,619 @@
+// Cached monitor geometry and hot zones
+
+use std::cell::Cell;
+
+pub const EDGES: [Edge; 8] = [
+	Edge::TOPLEFT,
+	Edge::TOPRIGHT,
+	Edge::BOTTOMRIGHT,
+	Edge::BOTTOMLEFT,
+	Edge::LEFT,
+	Edge::TOP,
+	Edge::RIGHT,
+	Edge::BOTTOM,
+];
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum Edge {
+	TOPLEFT,
+	TOPRIGHT,
+	BOTTOMRIGHT,
+	BOTTOMLEFT,
+	LEFT,
+	TOP,
+	RIGHT,
+	BOTTOM,
+	NONE,
+}
+
+impl Edge {
+	// Name used in the config file and options
+	pub fn name(&self) -> &'static str
+	{
+		return match self {
+			Edge::TOPLEFT => "topleft",
+			Edge::TOPRIGHT => "topright",
+			Edge::BOTTOMRIGHT => "bottomright",
+			Edge::BOTTOMLEFT => "bottomleft",
+			Edge::LEFT => "left",
+			Edge::TOP => "top",
+			Edge::RIGHT => "right",
+			Edge::BOTTOM => "bottom",
+			Edge::NONE => "none",
+		};
+	}
+}
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Rect {
+	pub x: i32,
+	pub y: i32,
+	pub w: i32,
+	pub h: i32,
+}
+
+impl Rect {
+	pub fn contains(&self, x: i32, y: i32) -> bool
+	{
+		return (self.x <= x && x < self.x + self.w) &&
+		       (self.y <= y && y < self.y + self.h);
+	}
+
+	// Chebyshev distance in pixels, 0 inside the rectangle
+	pub fn distance(&self, x: i32, y: i32) -> i32
+	{
+		let dx = (self.x - x).max(x - (self.x + self.w - 1)).max(0);
+		let dy = (self.y - y).max(y - (self.y + self.h - 1)).max(0);
+
+		return dx.max(dy);
+	}
+}
+
+// Length of the hot part of a monitor side, centered on it
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum Span {
+	PIXELS(i32),
+	FRACTION(f64),
+}
+
+impl Span {
+	// Parses "300" pixels or "50%" of the side
+	pub fn parse(s: &str) -> Result<Span, String>
+	{
+		let s = s.trim();
+
+		if let Some(percent) = s.strip_suffix('%') {
+			return match percent.trim().parse::<f64>() {
+				Ok(p) if (0.0..=100.0).contains(&p) => Ok(Span::FRACTION(p / 100.0)),
+				_ => Err(format!("invalid span: {}", s)),
+			};
+		}
+
+		return match s.parse::<i32>() {
+			Ok(px) if px >= 0 => Ok(Span::PIXELS(px)),
+			_ => Err(format!("invalid span: {}", s)),
+		};
+	}
+}
+
+// Sizes of the hot zones per edge. Corners are squares of that many
+// pixels, only they use corner and only the sides use span.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Zones {
+	pub corner: [i32; 8],
+	pub span: [Span; 8],
+}
+
+impl Zones {
+	pub fn new() -> Zones
+	{
+		return Zones { corner: [1; 8], span: [Span::FRACTION(0.5); 8] };
+	}
+}
+
+#[derive(Debug)]
+pub struct Monitor {
+	pub rect: Rect,
+
+	// Output name like DP-1, empty if the backend has none
+	pub name: String,
+
+	pub xmin: i32,
+	pub ymin: i32,
+	pub xmax: i32,
+	pub ymax: i32,
+
+	// How far the hot zones reach in from the bounds
+	pub depth: i32,
+
+	// Corner sizes and the first and last hot pixel along each side,
+	// precomputed from the zones in the order of EDGES
+	corner: [i32; 4],
+	band: [(i32, i32); 4],
+}
+
+impl Monitor {
+	fn new(rect: Rect) -> Monitor
+	{
+		let xmax = rect.x + rect.w - 1;
+		let ymax = rect.y + rect.h - 1;
+
+		let mut m = Monitor {
+			rect,
+			name: String::new(),
+			xmin: rect.x,
+			ymin: rect.y,
+			xmax,
+			ymax,
+			depth: 0,
+			corner: [1; 4],
+			band: [(0, -1); 4],
+		};
+		m.set_zones(&Zones::new());
+
+		return m;
+	}
+
+	// Specifies the "hot" zones
+	fn set_zones(&mut self, zones: &Zones)
+	{
+		for i in 0..4 {
+			self.corner[i] = zones.corner[i].clamp(1, self.rect.w.min(self.rect.h).max(1));
+		}
+		self.depth = self.corner.iter().max().unwrap() - 1;
+
+		// Sides run between the corners at their ends, horizontal ones
+		// along the width
+		for (i, side) in [Edge::LEFT, Edge::TOP, Edge::RIGHT, Edge::BOTTOM].into_iter().enumerate() {
+			let (min, max, a, b) = match side {
+				Edge::LEFT => (self.ymin, self.ymax, 0, 3),
+				Edge::TOP => (self.xmin, self.xmax, 0, 1),
+				Edge::RIGHT => (self.ymin, self.ymax, 1, 2),
+				_ => (self.xmin, self.xmax, 3, 2),
+			};
+			let len = max - min + 1;
+
+			let (start, end) = match zones.span[side as usize] {
+				Span::FRACTION(f) => {
+					let offset = ((len - 1) as f64 * (1.0 - f) / 2.0) as i32;
+					(min + offset + 1, max - offset - 1)
+				}
+				Span::PIXELS(px) => {
+					let start = min + (len - px.min(len)) / 2;
+					(start, start + px.min(len) - 1)
+				}
+			};
+
+			self.band[i] = (start.max(min + self.corner[a]), end.min(max - self.corner[b]));
+		}
+	}
+
+	// Returns the rectangle covered by a hot zone
+	pub fn zone(&self, edge: Edge) -> Rect
+	{
+		let c = &self.corner;
+		let band = |i: usize| (self.band[i].0, self.band[i].1 - self.band[i].0 + 1);
+
+		let (x, y, w, h) = match edge {
+			Edge::TOPLEFT => (self.xmin, self.ymin, c[0], c[0]),
+			Edge::TOPRIGHT => (self.xmax - c[1] + 1, self.ymin, c[1], c[1]),
+			Edge::BOTTOMRIGHT => (self.xmax - c[2] + 1, self.ymax - c[2] + 1, c[2], c[2]),
+			Edge::BOTTOMLEFT => (self.xmin, self.ymax - c[3] + 1, c[3], c[3]),
+			Edge::LEFT => (self.xmin, band(0).0, 1, band(0).1),
+			Edge::TOP => (band(1).0, self.ymin, band(1).1, 1),
+			Edge::RIGHT => (self.xmax, band(2).0, 1, band(2).1),
+			Edge::BOTTOM => (band(3).0, self.ymax, band(3).1, 1),
+			Edge::NONE => (0, 0, 0, 0),
+		};
+
+		return Rect { x, y, w: w.max(0), h: h.max(0) };
+	}
+
+	// One bit per zone in the order of EDGES, the lowest set bit wins, so
+	// corners go before sides, no branches
+	pub fn classify(&self, x: i32, y: i32) -> Edge
+	{
+		let (c, band) = (&self.corner, &self.band);
+		let (left, right) = (x - self.xmin, self.xmax - x);
+		let (top, bottom) = (y - self.ymin, self.ymax - y);
+
+		let bits = ((left < c[0] && top < c[0]) as u8) |
+			   ((right < c[1] && top < c[1]) as u8) << 1 |
+			   ((right < c[2] && bottom < c[2]) as u8) << 2 |
+			   ((left < c[3] && bottom < c[3]) as u8) << 3 |
+			   ((left == 0 && y >= band[0].0 && y <= band[0].1) as u8) << 4 |
+			   ((top == 0 && x >= band[1].0 && x <= band[1].1) as u8) << 5 |
+			   ((right == 0 && y >= band[2].0 && y <= band[2].1) as u8) << 6 |
+			   ((bottom == 0 && x >= band[3].0 && x <= band[3].1) as u8) << 7;
+
+		return ZONES[bits.trailing_zeros() as usize];
+	}
+}
+
+// Zone of the lowest bit set in classify, NONE without any
+const ZONES: [Edge; 9] = [
+	Edge::TOPLEFT,
+	Edge::TOPRIGHT,
+	Edge::BOTTOMRIGHT,
+	Edge::BOTTOMLEFT,
+	Edge::LEFT,
+	Edge::TOP,
+	Edge::RIGHT,
+	Edge::BOTTOM,
+	Edge::NONE,
+];
+
+const NO_MONITOR: u16 = u16::MAX;
+
+#[derive(Debug)]
+pub struct Layout {
+	pub monitors: Vec<Monitor>,
+
+	// Grid of all monitor boundaries, each cell maps to a monitor
+	xs: Vec<i32>,
+	ys: Vec<i32>,
+	cells: Vec<u16>,
+
+	// Monitor of the last lookup, checked first
+	last: Cell<usize>,
+
+	// Chosen once per layout, a single monitor needs neither the grid
+	// nor the neighbour checks
+	single: bool,
+}
+
+impl Layout {
+	// Builds the layout from the screen size and the monitor rectangles
+	pub fn new(width: i32, height: i32, rects: &[Rect]) -> Layout
+	{
+		let mut monitors = Vec::with_capacity(rects.len());
+
+		if rects.is_empty() {
+			monitors.push(Monitor::new(Rect { x: 0, y: 0, w: width, h: height }));
+		} else {
+			for rect in rects.iter().take(NO_MONITOR as usize) {
+				monitors.push(Monitor::new(*rect));
+			}
+		}
+
+		let mut xs: Vec<i32> = Vec::with_capacity(monitors.len() * 2);
+		let mut ys: Vec<i32> = Vec::with_capacity(monitors.len() * 2);
+
+		for m in &monitors {
+			xs.push(m.rect.x);
+			xs.push(m.rect.x + m.rect.w);
+			ys.push(m.rect.y);
+			ys.push(m.rect.y + m.rect.h);
+		}
+		xs.sort_unstable();
+		xs.dedup();
+		ys.sort_unstable();
+		ys.dedup();
+
+		// Overlapping (cloned) monitors resolve to the first one
+		let mut cells = vec![NO_MONITOR; xs.len() * ys.len()];
+		for i in 0..xs.len().saturating_sub(1) {
+			for j in 0..ys.len().saturating_sub(1) {
+				let cell = &mut cells[i * ys.len() + j];
+				if let Some(k) = monitors.iter().position(|m| m.rect.contains(xs[i], ys[j])) {
+					*cell = k as u16;
+				}
+			}
+		}
+
+		let single = monitors.len() == 1;
+
+		return Layout { monitors, xs, ys, cells, last: Cell::new(0), single };
+	}
+
+	// Takes the path of several monitors even for a single one, so that
+	// benchmarks can compare both
+	#[doc(hidden)]
+	pub fn generic(mut self) -> Layout
+	{
+		self.single = false;
+
+		return self;
+	}
+
+	pub fn rects(&self) -> Vec<Rect>
+	{
+		return self.monitors.iter().map(|m| m.rect).collect();
+	}
+
+	pub fn names(&self) -> Vec<String>
+	{
+		return self.monitors.iter().map(|m| m.name.clone()).collect();
+	}
+
+	// Resizes the hot zones of all monitors
+	pub fn set_zones(&mut self, zones: &Zones)
+	{
+		for m in self.monitors.iter_mut() {
+			m.set_zones(zones);
+		}
+	}
+
+	// Names the monitors in the order of the rectangles
+	pub fn set_names(&mut self, names: Vec<String>)
+	{
+		for (m, name) in self.monitors.iter_mut().zip(names) {
+			m.name = name;
+		}
+	}
+
+	// Returns the index of the monitor containing the position
+	pub fn find(&self, x: i32, y: i32) -> Option<usize>
+	{
+		let last = self.last.get();
+		if self.monitors[last].rect.contains(x, y) {
+			return Some(last);
+		}
+
+		let i = self.xs.partition_point(|&v| v <= x);
+		let j = self.ys.partition_point(|&v| v <= y);
+		if i == 0 || i == self.xs.len() || j == 0 || j == self.ys.len() {
+			return None;
+		}
+
+		let k = self.cells[(i - 1) * self.ys.len() + (j - 1)];
+		if k == NO_MONITOR {
+			return None;
+		}
+
+		self.last.set(k as usize);
+
+		return Some(k as usize);
+	}
+
+	fn covered(&self, x: i32, y: i32) -> bool
+	{
+		return self.find(x, y).is_some();
+	}
+
+	// Returns the parts of the monitor sides that border no other monitor,
+	// as one pixel wide rectangles on the side (LEFT, TOP, RIGHT, BOTTOM)
+	pub fn outline(&self) -> Vec<(Edge, Rect)>
+	{
+		let mut outline = Vec::new();
+
+		for m in &self.monitors {
+			for side in [Edge::LEFT, Edge::TOP, Edge::RIGHT, Edge::BOTTOM] {
+				let vertical = side == Edge::LEFT || side == Edge::RIGHT;
+				let (start, end, cuts) = if vertical {
+					(m.ymin, m.ymax + 1, &self.ys)
+				} else {
+					(m.xmin, m.xmax + 1, &self.xs)
+				};
+
+				// Coverage beyond the side only changes at the grid lines
+				let mut bounds: Vec<i32> = cuts.iter().copied().filter(|&v| v > start && v < end).collect();
+				bounds.insert(0, start);
+				bounds.push(end);
+
+				let mut open: Option<i32> = None;
+				for w in bounds.windows(2) {
+					let exposed = !match side {
+						Edge::LEFT => self.covered(m.xmin - 1, w[0]),
+						Edge::TOP => self.covered(w[0], m.ymin - 1),
+						Edge::RIGHT => self.covered(m.xmax + 1, w[0]),
+						_ => self.covered(w[0], m.ymax + 1),
+					};
+
+					match (exposed, open) {
+						(true, None) => open = Some(w[0]),
+						(false, Some(a)) => {
+							outline.push((side, segment(m, side, a, w[0])));
+							open = None;
+						}
+						_ => {}
+					}
+				}
+				if let Some(a) = open {
+					outline.push((side, segment(m, side, a, end)));
+				}
+			}
+		}
+
+		return outline;
+	}
+
+	// Returns the monitor and the hot zone the position is in.
+	// Edges shared with a neighbour monitor are not hot, the pointer
+	// just passes through them.
+	pub fn locate(&self, x: i32, y: i32) -> Option<(usize, Edge)>
+	{
+		if self.single {
+			let m = &self.monitors[0];
+			if !m.rect.contains(x, y) {
+				return None;
+			}
+			return Some((0, m.classify(x, y)));
+		}
+
+		let i = self.find(x, y)?;
+		let m = &self.monitors[i];
+
+		let edge = m.classify(x, y);
+		if edge == Edge::NONE {
+			return Some((i, edge));
+		}
+
+		// Neighbours are probed one pixel past the monitor bounds, at the
+		// pointer position along the other axis, corners reach inwards
+		let (ox, oy) = match edge {
+			Edge::TOPLEFT => (Some(m.xmin - 1), Some(m.ymin - 1)),
+			Edge::TOPRIGHT => (Some(m.xmax + 1), Some(m.ymin - 1)),
+			Edge::BOTTOMRIGHT => (Some(m.xmax + 1), Some(m.ymax + 1)),
+			Edge::BOTTOMLEFT => (Some(m.xmin - 1), Some(m.ymax + 1)),
+			Edge::LEFT => (Some(m.xmin - 1), None),
+			Edge::TOP => (None, Some(m.ymin - 1)),
+			Edge::RIGHT => (Some(m.xmax + 1), None),
+			Edge::BOTTOM => (None, Some(m.ymax + 1)),
+			Edge::NONE => (None, None),
+		};
+
+		let blocked = match (ox, oy) {
+			(Some(ox), Some(oy)) => !self.covered(ox, y) && !self.covered(x, oy) && !self.covered(ox, oy),
+			(Some(ox), None) => !self.covered(ox, y),
+			(None, Some(oy)) => !self.covered(x, oy),
+			(None, None) => true,
+		};
+
+		// Lookups of the neighbours must not evict the hit monitor
+		self.last.set(i);
+
+		if blocked {
+			return Some((i, edge));
+		}
+		return Some((i, Edge::NONE));
+	}
+}
+
+// Part [a, b) of a monitor side
+fn segment(m: &Monitor, side: Edge, a: i32, b: i32) -> Rect
+{
+	return match side {
+		Edge::LEFT => Rect { x: m.xmin, y: a, w: 1, h: b - a },
+		Edge::TOP => Rect { x: a, y: m.ymin, w: b - a, h: 1 },
+		Edge::RIGHT => Rect { x: m.xmax, y: a, w: 1, h: b - a },
+		_ => Rect { x: a, y: m.ymax, w: b - a, h: 1 },
+	};
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	fn dual() -> Layout
+	{
+		return Layout::new(3840, 1080, &[
+			Rect { x: 0, y: 0, w: 1920, h: 1080 },
+			Rect { x: 1920, y: 0, w: 1920, h: 1080 },
+		]);
+	}
+
+	#[test]
+	fn span_parse()
+	{
+		assert_eq!(Span::parse("300"), Ok(Span::PIXELS(300)));
+		assert_eq!(Span::parse(" 25% "), Ok(Span::FRACTION(0.25)));
+		assert!(Span::parse("-1").is_err());
+		assert!(Span::parse("120%").is_err());
+		assert!(Span::parse("wide").is_err());
+	}
+
+	#[test]
+	fn classify_single_monitor()
+	{
+		let layout = Layout::new(1920, 1080, &[]);
+		let m = &layout.monitors[0];
+
+		assert_eq!(m.classify(0, 0), Edge::TOPLEFT);
+		assert_eq!(m.classify(1919, 0), Edge::TOPRIGHT);
+		assert_eq!(m.classify(1919, 1079), Edge::BOTTOMRIGHT);
+		assert_eq!(m.classify(0, 1079), Edge::BOTTOMLEFT);
+		assert_eq!(m.classify(0, 540), Edge::LEFT);
+		assert_eq!(m.classify(960, 0), Edge::TOP);
+		assert_eq!(m.classify(1919, 540), Edge::RIGHT);
+		assert_eq!(m.classify(960, 1079), Edge::BOTTOM);
+		assert_eq!(m.classify(960, 540), Edge::NONE);
+
+		// Sides are hot on the middle half by default
+		assert_eq!(m.classify(100, 0), Edge::NONE);
+		assert_eq!(m.zone(Edge::TOP), Rect { x: 480, y: 0, w: 960, h: 1 });
+		assert_eq!(m.zone(Edge::LEFT), Rect { x: 0, y: 270, w: 1, h: 540 });
+	}
+
+	#[test]
+	fn generic_path_agrees()
+	{
+		let (single, generic) = (Layout::new(1920, 1080, &[]), Layout::new(1920, 1080, &[]).generic());
+
+		for x in (-2..1922).step_by(3) {
+			for y in (-2..1082).step_by(3) {
+				assert_eq!(single.locate(x, y), generic.locate(x, y), "{} {}", x, y);
+			}
+		}
+	}
+
+	#[test]
+	fn zones_follow_corner_and_span()
+	{
+		let mut layout = Layout::new(1920, 1080, &[]);
+		let mut zones = Zones::new();
+		zones.corner = [10; 8];
+		zones.span[Edge::TOP as usize] = Span::PIXELS(100);
+		zones.span[Edge::LEFT as usize] = Span::FRACTION(1.0);
+		layout.set_zones(&zones);
+		let m = &layout.monitors[0];
+
+		assert_eq!(m.zone(Edge::TOPLEFT), Rect { x: 0, y: 0, w: 10, h: 10 });
+		assert_eq!(m.classify(9, 9), Edge::TOPLEFT);
+		assert_eq!(m.classify(10, 9), Edge::NONE);
+		assert_eq!(m.zone(Edge::TOP), Rect { x: 910, y: 0, w: 100, h: 1 });
+		// A full side runs between the corners
+		assert_eq!(m.zone(Edge::LEFT), Rect { x: 0, y: 10, w: 1, h: 1060 });
+		assert_eq!(m.depth, 9);
+	}
+
+	#[test]
+	fn find_and_gaps()
+	{
+		let layout = Layout::new(0, 0, &[
+			Rect { x: 0, y: 0, w: 1920, h: 1080 },
+			Rect { x: 1920, y: 0, w: 1280, h: 1024 },
+		]);
+
+		assert_eq!(layout.find(0, 0), Some(0));
+		assert_eq!(layout.find(1920, 1023), Some(1));
+		assert_eq!(layout.find(1920, 1024), None);
+		assert_eq!(layout.find(-1, 0), None);
+		assert_eq!(layout.locate(1920, 1050), None);
+	}
+
+	#[test]
+	fn shared_edges_are_not_hot()
+	{
+		let layout = dual();
+
+		assert_eq!(layout.locate(0, 540), Some((0, Edge::LEFT)));
+		assert_eq!(layout.locate(1919, 540), Some((0, Edge::NONE)));
+		assert_eq!(layout.locate(1920, 540), Some((1, Edge::NONE)));
+		assert_eq!(layout.locate(3839, 540), Some((1, Edge::RIGHT)));
+		assert_eq!(layout.locate(1919, 0), Some((0, Edge::NONE)));
+		assert_eq!(layout.locate(3839, 0), Some((1, Edge::TOPRIGHT)));
+	}
+
+	#[test]
+	fn outline_skips_shared_sides()
+	{
+		let outline = dual().outline();
+
+		assert!(outline.contains(&(Edge::LEFT, Rect { x: 0, y: 0, w: 1, h: 1080 })));
+		assert!(outline.contains(&(Edge::RIGHT, Rect { x: 3839, y: 0, w: 1, h: 1080 })));
+		assert!(!outline.iter().any(|&(side, r)| side == Edge::RIGHT && r.x == 1919));
+		assert!(!outline.iter().any(|&(side, r)| side == Edge::LEFT && r.x == 1920));
+		assert_eq!(outline.len(), 6);
+	}
+
+	#[test]
+	fn large_corners_on_dual_layout()
+	{
+		let mut layout = dual();
+		let mut zones = Zones::new();
+		zones.corner = [8; 8];
+		layout.set_zones(&zones);
+
+		assert_eq!(layout.locate(0, 0), Some((0, Edge::TOPLEFT)));
+		assert_eq!(layout.locate(3, 3), Some((0, Edge::TOPLEFT)));
+		assert_eq!(layout.locate(0, 3), Some((0, Edge::TOPLEFT)));
+		assert_eq!(layout.locate(3836, 3), Some((1, Edge::TOPRIGHT)));
+		assert_eq!(layout.locate(3839, 1079), Some((1, Edge::BOTTOMRIGHT)));
+
+		// Corners on the shared side are passed through
+		assert_eq!(layout.locate(1915, 3), Some((0, Edge::NONE)));
+		assert_eq!(layout.locate(1924, 1075), Some((1, Edge::NONE)));
+		assert_eq!(layout.locate(8, 8), Some((0, Edge::NONE)));
+	}
+}
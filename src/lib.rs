@@ -0,0 +1,7 @@
+// Edge detection without any X dependency, shared by the binary and
+// anything that wants to drive it from recorded or synthetic input
+
+pub mod layout;
+pub mod limit;
+pub mod replay;
+pub mod trigger;
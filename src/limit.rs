@@ -0,0 +1,162 @@
+// Per edge rate limiting of launches
+//
+// After a launch an edge cools down for a while, hits in between are
+// dropped. With coalescing they are kept instead, and a burst of hits
+// leads to a single launch once the cooldown is over, or once the
+// previous command of the edge exited.
+
+use std::time::Duration;
+use std::time::Instant;
+use crate::layout::Edge;
+use crate::layout::EDGES;
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum Verdict {
+	RUN,
+	// Dropped, with the reason
+	LIMITED(&'static str),
+	// Launched later, at most once per burst
+	COALESCED,
+}
+
+#[derive(Debug)]
+pub struct Limiter {
+	cooldown: [Duration; 8],
+	coalesce: [bool; 8],
+	// Last launch per edge
+	last: [Option<Instant>; 8],
+	// Monitor of the coalesced hit waiting per edge
+	pending: [Option<usize>; 8],
+	// Pending hits waiting for the command to exit rather than for the
+	// cooldown, they have no deadline
+	busy: [bool; 8],
+}
+
+impl Limiter {
+	pub fn new(cooldown: [Duration; 8], coalesce: [bool; 8]) -> Limiter
+	{
+		return Limiter { cooldown, coalesce, last: [None; 8], pending: [None; 8], busy: [false; 8] };
+	}
+
+	fn ready(&self, edge: Edge, now: Instant) -> bool
+	{
+		return match self.last[edge as usize] {
+			Some(last) => now.saturating_duration_since(last) >= self.cooldown[edge as usize],
+			None => true,
+		};
+	}
+
+	// Decides about a hit, busy if the previous command must exit first
+	pub fn check(&mut self, monitor: usize, edge: Edge, busy: bool, now: Instant) -> Verdict
+	{
+		let i = edge as usize;
+
+		if !busy && self.ready(edge, now) {
+			return Verdict::RUN;
+		}
+
+		if self.coalesce[i] {
+			self.pending[i] = Some(monitor);
+			self.busy[i] = busy;
+			return Verdict::COALESCED;
+		}
+
+		return Verdict::LIMITED(if busy { "still running" } else { "cooldown" });
+	}
+
+	pub fn ran(&mut self, edge: Edge, now: Instant)
+	{
+		self.last[edge as usize] = Some(now);
+		self.pending[edge as usize] = None;
+	}
+
+	// Returns when the next coalesced hit may launch. Those waiting for a
+	// command to exit are not timed, the loop wakes up on SIGCHLD, the
+	// helper or the executor and checks them with due().
+	pub fn deadline(&self) -> Option<Instant>
+	{
+		return EDGES.iter().filter(|&&edge| self.pending[edge as usize].is_some() && !self.busy[edge as usize])
+			.filter_map(|&edge| Some(self.last[edge as usize]? + self.cooldown[edge as usize]))
+			.min();
+	}
+
+	// Takes a coalesced hit that may launch now. Hits of running commands
+	// go on waiting for them to exit, without a deadline.
+	pub fn due(&mut self, now: Instant, busy: impl Fn(usize, Edge) -> bool) -> Option<(usize, Edge)>
+	{
+		for edge in EDGES {
+			let i = edge as usize;
+			if let Some(monitor) = self.pending[i] {
+				self.busy[i] = busy(monitor, edge);
+				if !self.busy[i] && self.ready(edge, now) {
+					self.pending[i] = None;
+					return Some((monitor, edge));
+				}
+			}
+		}
+
+		return None;
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn cooldown_drops_hits()
+	{
+		let t = Instant::now();
+		let mut cooldown = [Duration::ZERO; 8];
+		cooldown[Edge::TOP as usize] = Duration::from_millis(100);
+		let mut limiter = Limiter::new(cooldown, [false; 8]);
+
+		assert_eq!(limiter.check(0, Edge::TOP, false, t), Verdict::RUN);
+		limiter.ran(Edge::TOP, t);
+		assert_eq!(limiter.check(0, Edge::TOP, false, t + Duration::from_millis(50)), Verdict::LIMITED("cooldown"));
+		assert_eq!(limiter.check(0, Edge::LEFT, false, t), Verdict::RUN);
+		assert_eq!(limiter.check(0, Edge::LEFT, true, t), Verdict::LIMITED("still running"));
+		assert_eq!(limiter.check(0, Edge::TOP, false, t + Duration::from_millis(100)), Verdict::RUN);
+		assert_eq!(limiter.deadline(), None);
+	}
+
+	#[test]
+	fn coalesced_hits_launch_once()
+	{
+		let t = Instant::now();
+		let mut limiter = Limiter::new([Duration::from_millis(100); 8], [true; 8]);
+
+		limiter.ran(Edge::RIGHT, t);
+		assert_eq!(limiter.check(0, Edge::RIGHT, false, t), Verdict::COALESCED);
+		assert_eq!(limiter.check(1, Edge::RIGHT, false, t), Verdict::COALESCED);
+		assert_eq!(limiter.deadline(), Some(t + Duration::from_millis(100)));
+
+		let later = t + Duration::from_millis(100);
+		assert_eq!(limiter.due(t, |_, _| false), None);
+		assert_eq!(limiter.due(later, |_, _| true), None);
+		assert_eq!(limiter.due(later, |_, _| false), Some((1, Edge::RIGHT)));
+		assert_eq!(limiter.due(later, |_, _| false), None);
+	}
+	#[test]
+	fn running_commands_have_no_deadline()
+	{
+		let t = Instant::now();
+		let mut limiter = Limiter::new([Duration::ZERO; 8], [true; 8]);
+
+		limiter.ran(Edge::TOP, t);
+		assert_eq!(limiter.check(2, Edge::TOP, true, t), Verdict::COALESCED);
+		assert_eq!(limiter.deadline(), None);
+
+		let later = t + Duration::from_secs(1);
+		assert_eq!(limiter.due(later, |_, _| true), None);
+		assert_eq!(limiter.deadline(), None);
+		assert_eq!(limiter.due(later, |_, _| false), Some((2, Edge::TOP)));
+
+		// Exited within the cooldown, the rest of it is timed
+		let mut limiter = Limiter::new([Duration::from_millis(100); 8], [true; 8]);
+		limiter.ran(Edge::TOP, t);
+		limiter.check(0, Edge::TOP, true, t);
+		assert_eq!(limiter.due(t, |_, _| false), None);
+		assert_eq!(limiter.deadline(), Some(t + Duration::from_millis(100)));
+	}
+}
@@ -1,19 +1,59 @@
 use structopt::StructOpt;
-use x11::xlib;
-use x11::xrandr;
-use x11::xinput2;
-use std::ptr;
 use std::env;
-use std::ffi::CString;
-use std::mem::MaybeUninit;
-use std::ffi::CStr;
-use nix::unistd;
-use nix::sys;
+use std::io::Write;
+use std::path::Path;
+use std::path::PathBuf;
 use std::sync::atomic::AtomicBool;
+use std::sync::atomic::AtomicI32;
 use std::sync::atomic::Ordering;
-use configparser::ini::Ini;
+use backend::Backend;
+use backend::Sink;
+use config::Config;
+use config::Overrides;
+use control::Control;
+use config::Watch;
+use evdev::Evdev;
+// The other modules refer to crate::layout
+use edges::layout;
+use edges::layout::Edge;
+use edges::layout::Layout;
+use edges::layout::Span;
+use edges::limit::Limiter;
+use edges::limit::Verdict;
+use edges::replay::Player;
+use edges::replay::Record;
+use edges::replay::Recorder;
+use edges::trigger::Hit;
+use edges::trigger::Trigger;
+use trace::Format;
+use trace::Level;
+use trace::Tracer;
+use spawn::Action;
+use spawn::Launcher;
+use stats::Startup;
+use stats::Stats;
+use xorg::Xorg;
+use std::time::Duration;
+use std::time::Instant;
+
+mod backend;
+mod config;
+mod control;
+mod evdev;
+mod exec;
+mod spawn;
+mod stats;
+mod trace;
+#[cfg(feature = "xcb")]
+mod xcb;
+mod xorg;
 
 static RUNNING: AtomicBool = AtomicBool::new(true);
+static RELOAD: AtomicBool = AtomicBool::new(false);
+static DUMP: AtomicBool = AtomicBool::new(false);
+
+// Write end of the self-pipe that wakes up the main loop
+static WAKEUP_FD: AtomicI32 = AtomicI32::new(-1);
 
 #[derive(Debug, StructOpt)]
 struct Opts {
@@ -41,367 +81,895 @@ struct Opts {
 	#[structopt(long, value_name = "CMD", help = "Bottom edge command")]
 	bottom: Option<String>,
 
-	#[structopt(long, short, help = "Prints debug information")]
+	#[structopt(long, short, help = "Prints debug information, same as --log-level trace")]
 	debug: bool,
 
+	#[structopt(long, value_name = "LEVEL", default_value = "warn", help = "Log level: off, error, warn, info, debug or trace")]
+	log_level: Level,
+
+	#[structopt(long, value_name = "FORMAT", default_value = "text", help = "Log format: text or json")]
+	log_format: Format,
+
 	#[structopt(long, short, help = "Read commands from config file")]
 	config: bool,
 
 	#[structopt(long, short, help = "Block until a command exits")]
 	block: bool,
+
+	#[structopt(long, short, help = "Track the pointer from raw motion instead of querying it")]
+	track: bool,
+
+	#[structopt(long, help = "Wake only on pushes against pointer barriers at the edges")]
+	barriers: bool,
+
+	#[structopt(long, help = "Ignore the pointer while a fullscreen window covers its monitor")]
+	suspend_fullscreen: bool,
+
+	#[structopt(long, value_name = "PX", default_value = "0", help = "Sample the pointer by timer while it is farther from the monitor bounds")]
+	sparse: i32,
+
+	#[structopt(long, short, help = "Don't launch a command while the previous one still runs")]
+	exclusive: bool,
+
+	#[structopt(long, short, help = "Launch commands from a pre-forked helper process")]
+	warm: bool,
+
+	#[structopt(long, value_name = "MS", help = "Time the pointer must stay in a hot zone")]
+	dwell: Option<u64>,
+
+	#[structopt(long, value_name = "PX", help = "Distance to leave a hot zone before it fires again, 1 by default")]
+	rearm: Option<i32>,
+
+	#[structopt(long, value_name = "MS", help = "Minimum time between two launches of an edge")]
+	cooldown: Option<u64>,
+
+	#[structopt(long, help = "Launch once after a burst of hits instead of dropping them")]
+	coalesce: bool,
+
+	#[structopt(long, value_name = "PX", help = "Distance to push on past the edge before a hot zone fires")]
+	push: Option<u32>,
+
+	#[structopt(long, value_name = "PX", help = "Size of the hot corners, 1 by default")]
+	corner: Option<i32>,
+
+	#[structopt(long, value_name = "PX|N%", parse(try_from_str = Span::parse), help = "Length of the hot edges, 50% of the side by default")]
+	span: Option<Span>,
+
+	#[structopt(long, value_name = "PX/S", help = "Ignore hot zones entered faster than this")]
+	max_velocity: Option<u32>,
+
+	#[structopt(long, value_name = "FILE", parse(from_os_str), help = "Record the pointer positions to a file")]
+	record: Option<PathBuf>,
+
+	#[structopt(long, value_name = "FILE", parse(from_os_str), help = "Replay a recorded file instead of connecting to X")]
+	replay: Option<PathBuf>,
+
+	#[structopt(long, help = "Print how long each startup phase takes")]
+	startup_timing: bool,
+
+	#[structopt(long, help = "Replay as fast as possible instead of at recorded speed")]
+	replay_fast: bool,
+
+	#[structopt(long, value_name = "NAME", help = "Pointer input: x11, xcb or evdev, evdev by default on Wayland")]
+	backend: Option<String>,
+
+	#[structopt(long, value_name = "WxH+X+Y,...", help = "Monitor geometry for the evdev backend")]
+	geometry: Option<String>,
+
+	#[structopt(long, value_name = "REQUEST", help = "Send a request to the running instance and print the reply")]
+	ctl: Option<String>,
+
+	#[structopt(long, value_name = "DISPLAY,...", help = "X displays to serve from this one process, $DISPLAY by default")]
+	display: Option<String>,
 }
 
-#[derive(Debug)]
-struct Commands {
-	topleft: Option<String>,
-	topright: Option<String>,
-	bottomright: Option<String>,
-	bottomleft: Option<String>,
-	left: Option<String>,
-	top: Option<String>,
-	right: Option<String>,
-	bottom: Option<String>,
+extern "C" fn sighandler(_signum: libc::c_int) {
+	RUNNING.store(false, Ordering::Relaxed);
+	wakeup();
 }
 
-#[derive(Debug, PartialEq)]
-enum Edge {
-	TOPLEFT,
-	TOPRIGHT,
-	BOTTOMRIGHT,
-	BOTTOMLEFT,
-	LEFT,
-	TOP,
-	RIGHT,
-	BOTTOM,
-	NONE,
+extern "C" fn sighup(_signum: libc::c_int) {
+	RELOAD.store(true, Ordering::Relaxed);
+	wakeup();
 }
 
-fn sighandler() {
-	RUNNING.store(false, Ordering::Relaxed);
+extern "C" fn sigusr1(_signum: libc::c_int) {
+	DUMP.store(true, Ordering::Relaxed);
+	wakeup();
 }
 
-fn point_in_rect(x: i32, y: i32, rect: (i32, i32, i32, i32)) -> bool
-{
-	let (rx, ry, rw, rh) = rect;
+// Children are reaped from the main loop
+extern "C" fn sigchld(_signum: libc::c_int) {
+	wakeup();
+}
 
-	if (rx <= x && x < rx + rw) &&
-	   (ry <= y && y < ry + rh) {
-		return true;
+// Async-signal-safe, a full pipe already guarantees a pending wakeup
+fn wakeup()
+{
+	let fd = WAKEUP_FD.load(Ordering::Relaxed);
+	if fd >= 0 {
+		let byte: u8 = 1;
+		unsafe {
+			libc::write(fd, &byte as *const u8 as *const libc::c_void, 1);
+		}
 	}
-	return false;
 }
 
-fn pointer_in_monitor(x: i32, y: i32, nmonitors: i32, monitorinfo: *const xrandr::XRRMonitorInfo) -> i32
+// Returns the read end of a non-blocking self-pipe
+fn wakeup_pipe() -> i32
 {
-	for i in 0..nmonitors {
-		let rect = unsafe {
-			((*monitorinfo.offset(i as isize)).x,
-			 (*monitorinfo.offset(i as isize)).y,
-			 (*monitorinfo.offset(i as isize)).width,
-			 (*monitorinfo.offset(i as isize)).height)
-		};
+	let mut fds = [-1i32; 2];
 
-		if point_in_rect(x, y, rect) {
-			return i;
+	unsafe {
+		if libc::pipe2(fds.as_mut_ptr(), libc::O_NONBLOCK | libc::O_CLOEXEC) < 0 {
+			panic!("pipe2 failed");
 		}
 	}
+	WAKEUP_FD.store(fds[1], Ordering::Relaxed);
 
-	return -1;
+	return fds[0];
 }
 
-fn get_xymax(x: i32, y: i32, xmax: &mut i32, ymax: &mut i32, display: *mut xlib::Display, nmonitors: i32, monitorinfo: *const xrandr::XRRMonitorInfo)
+fn drain(fd: i32)
 {
+	let mut buf = [0u8; 64];
+
 	unsafe {
-		*xmax = xlib::XDisplayWidth(display, xlib::XDefaultScreen(display)) - 1;
-		*ymax = xlib::XDisplayHeight(display, xlib::XDefaultScreen(display)) - 1;
+		while libc::read(fd, buf.as_mut_ptr() as *mut libc::c_void, buf.len()) > 0 {}
 	}
+}
 
-	if nmonitors == 1 {
-		return;
+// One display served by the process
+struct Seat {
+	daemon: Daemon,
+	backend: Box<dyn Backend>,
+	control: Option<Control>,
+}
+
+// Everything that reacts to pointer positions, fed by a backend
+struct Daemon {
+	tracer: Tracer,
+	stats: Stats,
+	trigger: Trigger,
+	limiter: Limiter,
+	launcher: Launcher,
+	recorder: Option<Recorder>,
+
+	// Monitor names the command table was built for
+	config: Config,
+	names: Vec<String>,
+
+	// Started with --config, there is a file to reload
+	config_file: bool,
+
+	// Edges turned off at runtime through the control socket
+	disabled: [bool; 8],
+
+	// Hits with builtin actions, run by the backend after dispatching
+	builtins: Vec<(usize, Edge)>,
+
+	// When the main loop last woke up, detection time is measured from it
+	woke: Instant,
+}
+
+impl Daemon {
+	fn hit(&mut self, layout: &Layout, x: i32, y: i32, delta: (f64, f64), now: Instant)
+	{
+		self.stats.startup.finish("first motion");
+		self.tracer.record(Level::TRACE, "motion", &[("x", x.into()), ("y", y.into())]);
+		if let Some(recorder) = &mut self.recorder {
+			recorder.motion(x, y, delta, now);
+		}
+
+		let hit = self.trigger.motion(layout, x, y, delta, now);
+		let detect = self.woke.elapsed();
+		let latency = detect.as_micros() as i64;
+		self.stats.processed += 1;
+		self.stats.detect.add(detect);
+
+		match hit {
+			Hit::FIRE(monitor, edge) => {
+				self.tracer.record(Level::DEBUG, "hit", &[("edge", edge.name().into()),
+									 ("monitor", monitor.into()),
+									 ("latency_us", latency.into())]);
+				self.run(monitor, edge, now);
+			}
+			Hit::SUPPRESSED(monitor, edge, reason) => {
+				self.stats.suppressed += 1;
+				self.tracer.record(Level::DEBUG, "suppressed", &[("edge", edge.name().into()),
+										("monitor", monitor.into()),
+										("reason", reason.into()),
+										("latency_us", latency.into())]);
+			}
+			Hit::NONE => {}
+		}
 	}
 
-	let i = pointer_in_monitor(x, y, nmonitors, monitorinfo);
-	if i < 0 {
-		panic!("pointer_in_mointor failed");
+	// Fires zones whose dwell time is over
+	fn expire(&mut self, now: Instant)
+	{
+		while let Some((monitor, edge)) = self.trigger.expire(now) {
+			self.tracer.record(Level::DEBUG, "hit", &[("edge", edge.name().into()),
+								 ("monitor", monitor.into()),
+								 ("reason", "dwell".into())]);
+			self.run(monitor, edge, now);
+		}
+
+		// Coalesced hits whose cooldown is over or whose command exited
+		loop {
+			let (launcher, coalesce) = (&self.launcher, self.config.coalesce);
+			let (monitor, edge) = match self.limiter.due(now, |m, e| busy(launcher, coalesce, m, e)) {
+				Some(hit) => hit,
+				None => break,
+			};
+
+			self.tracer.record(Level::DEBUG, "hit", &[("edge", edge.name().into()),
+								 ("monitor", monitor.into()),
+								 ("reason", "coalesced".into())]);
+			self.launch(monitor, edge, now);
+		}
 	}
 
-	unsafe {
-		let w = (*monitorinfo.offset(i as isize)).width;
-		let xoff = (*monitorinfo.offset(i as isize)).x;
+	// Returns when a dwell time or a cooldown is over
+	fn deadline(&self) -> Option<Instant>
+	{
+		return match (self.trigger.deadline(), self.limiter.deadline()) {
+			(Some(a), Some(b)) => Some(a.min(b)),
+			(a, b) => a.or(b),
+		};
+	}
 
-		if xoff + w <= *xmax {
-			*xmax = xoff + w - 1;
+	// Swaps in a config only if all of it is valid
+	fn swap(&mut self, config: Config) -> Result<(), String>
+	{
+		let table = config.actions(&self.names)?;
+
+		if let Err(err) = self.launcher.set_actions(table, config.exclusive) {
+			self.tracer.record(Level::ERROR, "launcher", &[("error", err.into())]);
 		}
+		self.trigger = Trigger::new(Duration::from_millis(config.dwell), config.rearm, config.push, config.max_velocity);
+		self.limiter = limiter(&config);
+		self.config = config;
+
+		return Ok(());
+	}
 
-		let h = (*monitorinfo.offset(i as isize)).height;
-		let yoff = (*monitorinfo.offset(i as isize)).y;
+	fn run(&mut self, monitor: usize, edge: Edge, now: Instant)
+	{
+		if self.launcher.action(monitor, edge).is_none() {
+			self.tracer.record(Level::DEBUG, "suppressed", &[("edge", edge.name().into()),
+									("monitor", monitor.into()),
+									("reason", "no command".into())]);
+			return;
+		}
 
-		if yoff + h <= *ymax {
-			*ymax = yoff + h - 1;
+		if self.disabled[edge as usize] {
+			self.stats.suppressed += 1;
+			self.tracer.record(Level::DEBUG, "suppressed", &[("edge", edge.name().into()),
+									("monitor", monitor.into()),
+									("reason", "disabled".into())]);
+			return;
 		}
+
+		let busy = busy(&self.launcher, self.config.coalesce, monitor, edge);
+		match self.limiter.check(monitor, edge, busy, now) {
+			Verdict::RUN => {}
+			Verdict::LIMITED(reason) => {
+				self.stats.suppressed += 1;
+				self.tracer.record(Level::DEBUG, "suppressed", &[("edge", edge.name().into()),
+										("monitor", monitor.into()),
+										("reason", reason.into())]);
+				return;
+			}
+			Verdict::COALESCED => {
+				self.stats.coalesced += 1;
+				self.tracer.record(Level::DEBUG, "coalesced", &[("edge", edge.name().into()),
+										("monitor", monitor.into())]);
+				return;
+			}
+		}
+
+		self.launch(monitor, edge, now);
 	}
-}
 
-fn in_edge(x: i32, y: i32, xmax: i32, ymax: i32, offset: i32) -> Edge
-{
-	if x == 0 && y == 0 {
-		return Edge::TOPLEFT;
-	} else if x == xmax && y == 0 {
-		return Edge::TOPRIGHT;
-	} else if x == xmax && y == ymax {
-		return Edge::BOTTOMRIGHT;
-	} else if x == 0 && y == ymax {
-		return Edge::BOTTOMLEFT;
-	} else if x == 0 && y > offset && y < ymax - offset {
-		return Edge::LEFT;
-	} else if y == 0 && x > offset && x < xmax - offset {
-		return Edge::TOP;
-	} else if x == xmax && y > offset && y < ymax - offset {
-		return Edge::RIGHT;
-	} else if y == ymax && x > offset && x < xmax - offset {
-		return Edge::BOTTOM;
-	} else {
-		return Edge::NONE;
+	fn launch(&mut self, monitor: usize, edge: Edge, now: Instant)
+	{
+		self.limiter.ran(edge, now);
+
+		if self.tracer.enabled(Level::INFO) {
+			let action = format!("{:?}", self.launcher.action(monitor, edge));
+			self.tracer.record(Level::INFO, "run", &[("edge", edge.name().into()),
+								("monitor", monitor.into()),
+								("action", action.as_str().into())]);
+		}
+
+		if let Some(Action::Builtin(_)) = self.launcher.action(monitor, edge) {
+			self.builtins.push((monitor, edge));
+			return;
+		}
+
+		// The spawn is timed where it runs, reported when reaped
+		if let Err(err) = self.launcher.run(monitor, edge) {
+			self.tracer.record(Level::ERROR, "launch", &[("edge", edge.name().into()),
+								   ("monitor", monitor.into()),
+								   ("error", err.into())]);
+		}
 	}
-}
 
-fn run(opts: &Opts, edge: Edge, cmds: &Commands)
-{
-	let cmd = match edge {
-		Edge::TOPLEFT => &cmds.topleft,
-		Edge::TOPRIGHT => &cmds.topright,
-		Edge::BOTTOMRIGHT => &cmds.bottomright,
-		Edge::BOTTOMLEFT => &cmds.bottomleft,
-		Edge::LEFT => &cmds.left,
-		Edge::TOP => &cmds.top,
-		Edge::RIGHT => &cmds.right,
-		Edge::BOTTOM => &cmds.bottom,
-		_ => &None,
-	};
+	// Collects finished commands and the spawn times and errors of launches
+	fn reap(&mut self)
+	{
+		let (tracer, stats) = (&mut self.tracer, &mut self.stats);
 
-	if opts.debug {
-		println!("{:?}: {:?}", edge, cmd);
+		self.launcher.reap(|slot, time, errno| {
+			stats.spawn[slot % 8].add(time);
+			if errno == 0 {
+				return;
+			}
+
+			let err = std::io::Error::from_raw_os_error(errno).to_string();
+			tracer.record(Level::WARN, "launch", &[("edge", layout::EDGES[slot % 8].name().into()),
+							       ("row", (slot / 8).into()),
+							       ("error", err.as_str().into())]);
+		});
 	}
 
-	if cmd.is_none() {
-		return;
+	// Runs the queued builtin actions over the connection of the backend
+	fn run_builtins(&mut self, backend: &mut dyn Backend)
+	{
+		for (monitor, edge) in self.builtins.drain(..) {
+			if let Some(Action::Builtin(builtin)) = self.launcher.action(monitor, edge) {
+				let start = Instant::now();
+				if let Err(err) = backend.builtin(builtin) {
+					self.tracer.record(Level::WARN, "builtin", &[("edge", edge.name().into()),
+										 ("error", err.as_str().into())]);
+				}
+				self.stats.spawn[edge as usize].add(start.elapsed());
+			}
+		}
+	}
+}
+
+fn parse_edges(words: &[&str]) -> Result<Vec<Edge>, String>
+{
+	if words.is_empty() {
+		return Ok(layout::EDGES.to_vec());
 	}
 
-	// Split to C strings for execvp
-	let s: String = cmd.as_ref().unwrap().to_string();
-	let split: Vec<&str> = s.split_whitespace().collect();
-	let vec: Vec<CString> = split.iter().map(|s| CString::new(s.as_bytes()).unwrap()).collect();
-	let args: Vec<&CStr> = vec.iter().map(|c| c.as_c_str()).collect();
+	return words.iter().map(|w| parse_edge(w)).collect();
+}
 
-	unsafe {
-		match unistd::fork() {
-			Ok(unistd::ForkResult::Child) => {
-				let _ = unistd::execvp(args[0], &args);
-				libc::_exit(0);
+fn parse_edge(word: &str) -> Result<Edge, String>
+{
+	return layout::EDGES.iter().copied().find(|e| e.name() == word).ok_or(format!("unknown edge: {}", word));
+}
+
+impl Daemon {
+	// Handles a request from the control socket, returns the reply
+	fn control(&mut self, request: &str) -> Result<String, String>
+	{
+		let words: Vec<&str> = request.split_whitespace().collect();
+
+		match words.first().copied().unwrap_or("") {
+			"status" => {
+				let mut reply = format!("pid {}\n", std::process::id());
+				for edge in layout::EDGES {
+					let state = if self.disabled[edge as usize] { "disabled" } else { "enabled" };
+					let cmd = self.config.commands[edge as usize].as_deref().unwrap_or("");
+					reply.push_str(&format!("{:<12} {:<8} {}\n", edge.name(), state, cmd));
+				}
+				reply.push_str(&self.stats.dump());
+				return Ok(reply);
 			}
-			Ok(unistd::ForkResult::Parent {..}) => {
-				if opts.block {
-					let _ = sys::wait::wait();
+			"enable" | "disable" => {
+				for edge in parse_edges(&words[1..])? {
+					self.disabled[edge as usize] = words[0] == "disable";
 				}
 			}
-			Err(_) => println!("Fork failed"),
+			"trigger" => {
+				let edge = parse_edge(words.get(1).ok_or("trigger needs an edge")?)?;
+				let monitor = match words.get(2) {
+					Some(w) => w.parse::<usize>().map_err(|_| format!("invalid monitor: {}", w))?,
+					None => 0,
+				};
+				self.run(monitor, edge, Instant::now());
+			}
+			"set" => {
+				let edge = parse_edge(words.get(1).ok_or("set needs an edge")?)?;
+				// The rest of the line after the edge, with its quoting
+				let rest = request.trim().splitn(2, char::is_whitespace).nth(1).unwrap_or("").trim_start();
+				let cmd = rest[words[1].len()..].trim();
+				let mut config = self.config.clone();
+				config.commands[edge as usize] = if cmd.is_empty() { None } else { Some(cmd.to_string()) };
+				self.swap(config)?;
+			}
+			"reload" if !self.config_file => return Err("reload needs --config".to_string()),
+			"reload" => RELOAD.store(true, Ordering::Relaxed),
+			"quit" => RUNNING.store(false, Ordering::Relaxed),
+			other => return Err(format!("unknown request: {}", other)),
 		}
+
+		return Ok(String::new());
 	}
 }
 
-fn main()
+// Must the previous command of the edge exit before the next launch?
+fn busy(launcher: &Launcher, coalesce: [bool; 8], monitor: usize, edge: Edge) -> bool
 {
-	let opts = Opts::from_args();
-
-	// Set commands from arguments
-	let mut cmds = Commands {
-		topleft: opts.topleft.clone(),
-		topright: opts.topright.clone(),
-		bottomright: opts.bottomright.clone(),
-		bottomleft: opts.bottomleft.clone(),
-		left: opts.left.clone(),
-		top: opts.top.clone(),
-		right: opts.right.clone(),
-		bottom: opts.bottom.clone(),
-	};
+	let i = edge as usize;
+
+	return (launcher.exclusive[i] || coalesce[i] || launcher.block) && launcher.running(monitor, edge);
+}
+
+fn limiter(config: &Config) -> Limiter
+{
+	return Limiter::new(config.cooldown.map(Duration::from_millis), config.coalesce);
+}
 
-	// Load commands from file
-	if opts.config {
-		let mut cfg = Ini::new();
-		let mut path = dirs::config_dir().unwrap();
-		path.push("edges.conf");
-		if let Err(err) = cfg.load(path) {
-			panic!("{}", err);
+impl Sink for Daemon {
+	fn layout(&mut self, layout: &Layout)
+	{
+		self.trigger.reset();
+		if let Some(recorder) = &mut self.recorder {
+			recorder.layout(&layout.rects());
+		}
+
+		// Rows of the command table follow the monitors
+		let names = layout.names();
+		if !self.config.monitors.is_empty() && names != self.names {
+			self.names = names;
+			if let Err(err) = self.swap(self.config.clone()) {
+				self.tracer.record(Level::ERROR, "layout", &[("error", err.as_str().into())]);
+			}
 		}
-		cmds.topleft = cfg.get("commands", "topleft");
-		cmds.topright = cfg.get("commands", "topright");
-		cmds.bottomright = cfg.get("commands", "bottomright");
-		cmds.bottomleft = cfg.get("commands", "bottomleft");
-		cmds.left = cfg.get("commands", "left");
-		cmds.top = cfg.get("commands", "top");
-		cmds.right = cfg.get("commands", "right");
-		cmds.bottom = cfg.get("commands", "bottom");
 	}
 
-	// Check if we run on Wayland
-	if let Ok(_) = env::var("WAYLAND_DISPLAY") {
-		panic!("Global pointer query not supported on Wayland");
+	fn motion(&mut self, layout: &Layout, x: i32, y: i32, delta: (f64, f64))
+	{
+		self.hit(layout, x, y, delta, Instant::now());
 	}
 
-	unsafe {
-		// Catch signals
-		libc::signal(libc::SIGINT, sighandler as usize);
-		libc::signal(libc::SIGTERM, sighandler as usize);
-		libc::signal(libc::SIGHUP, sighandler as usize);
+	fn stats(&mut self) -> &mut Stats
+	{
+		return &mut self.stats;
+	}
+
+	fn suspended(&mut self, suspended: bool)
+	{
+		self.trigger.reset();
+		self.tracer.record(Level::INFO, if suspended { "suspended" } else { "resumed" }, &[]);
+	}
+}
 
-		// Open display
-		let display = xlib::XOpenDisplay(ptr::null());
-		if display.is_null() {
-			panic!("XOpenDisplay failed");
+// Feeds a recorded trace to the trigger, timed by the recorded timestamps
+fn replay(daemon: &mut Daemon, path: &Path, fast: bool)
+{
+	let mut player = match Player::open(path) {
+		Ok(player) => player,
+		Err(err) => panic!("{}", err),
+	};
+
+	let mut layout: Option<(u16, Layout)> = None;
+	let base = Instant::now();
+
+	while let Some(record) = player.next() {
+		if !RUNNING.load(Ordering::Relaxed) {
+			break;
 		}
 
-		let window = xlib::XDefaultRootWindow(display);
+		let (time, x, y, generation, delta) = match record {
+			Record::LAYOUT(generation, rects) => {
+				let mut l = Layout::new(0, 0, &rects);
+				l.set_zones(&daemon.config.zones);
+				layout = Some((generation, l));
+				daemon.trigger.reset();
+				continue;
+			}
+			Record::MOTION { time, x, y, generation, delta } => (time, x, y, generation, delta),
+		};
+
+		// Motions always follow their layout, anything else is a broken file
+		let layout = match &layout {
+			Some((g, layout)) if *g == generation => layout,
+			_ => continue,
+		};
 
-		// Query XInput2
-		let mut major_opcode: i32 = 0;
-		let mut first_event: i32 = 0;
-		let mut first_error: i32 = 0;
-		let c_str = CString::new("XInputExtension").unwrap();
+		daemon.stats.events += 1;
 
-		if xlib::XQueryExtension(display,
-					 c_str.as_ptr(),
-					 &mut major_opcode,
-					 &mut first_event,
-					 &mut first_error) == xlib::False {
-			panic!("Failed to query XInputExtension");
+		// Time is virtual, so dwell behaves the same at any speed
+		let now = base + Duration::from_micros(time);
+		if !fast {
+			std::thread::sleep(now.saturating_duration_since(Instant::now()));
 		}
 
-		// Query Xrandr
-		let mut have_randr_1_5: bool = false;
-		let mut event_base: i32 = 0;
-		let mut error_base: i32 = 0;
+		daemon.expire(now);
+		daemon.woke = Instant::now();
+		daemon.hit(layout, x, y, delta, now);
 
-		if xrandr::XRRQueryExtension(display, &mut event_base, &mut error_base) == xlib::True {
-			let mut major: i32 = 0;
-			let mut minor: i32 = 0;
+		// There is no display to run builtins on
+		daemon.builtins.clear();
 
-			xrandr::XRRQueryVersion(display, &mut major, &mut minor);
+		daemon.tracer.flush();
+		daemon.reap();
+	}
+
+	let elapsed = base.elapsed();
+	let processed = daemon.stats.processed;
+	eprint!("{}", daemon.stats.dump());
+	eprintln!("replayed {} events in {:.3}s, {} ns/event", processed, elapsed.as_secs_f64(),
+		  elapsed.as_nanos() / (processed.max(1) as u128));
+}
+
+fn main()
+{
+	let start = Instant::now();
+	let mut opts = Opts::from_args();
+	let mut startup = Startup::new(opts.startup_timing, start);
+	startup.mark("options");
+
+	// Sent to every display given, in order
+	if let Some(request) = &opts.ctl {
+		let displays: Vec<Option<&str>> = match &opts.display {
+			Some(list) => list.split(',').map(|d| Some(d.trim())).collect(),
+			None => vec![None],
+		};
 
-			if (major == 1 && minor >= 5) || major > 1 {
-				have_randr_1_5 = true;
+		let mut failed = false;
+		for display in displays {
+			match control::send(request, display) {
+				Ok(reply) if !reply.starts_with("error:") => print!("{}", reply),
+				Ok(reply) => {
+					eprint!("{}", reply);
+					failed = true;
+				}
+				Err(err) => {
+					eprintln!("{}", err);
+					failed = true;
+				}
 			}
 		}
+		if failed {
+			std::process::exit(1);
+		}
+		return;
+	}
+
+	// Arguments override the file, also on reloads
+	let overrides = Overrides {
+		commands: [
+			opts.topleft.take(),
+			opts.topright.take(),
+			opts.bottomright.take(),
+			opts.bottomleft.take(),
+			opts.left.take(),
+			opts.top.take(),
+			opts.right.take(),
+			opts.bottom.take(),
+		],
+		dwell: opts.dwell,
+		rearm: opts.rearm,
+		push: opts.push,
+		max_velocity: opts.max_velocity,
+		exclusive: opts.exclusive,
+		cooldown: opts.cooldown,
+		coalesce: opts.coalesce,
+		corner: opts.corner,
+		span: opts.span,
+	};
 
-		if !have_randr_1_5 {
-			panic!("Xrandr >= 1.5 not available");
+	let config = match Config::load(&overrides, opts.config) {
+		Ok(config) => config,
+		Err(err) => panic!("{}", err),
+	};
+	startup.mark("config");
+
+	// Displays served by this process, None is $DISPLAY
+	let displays: Vec<Option<String>> = match &opts.display {
+		Some(list) => list.split(',').map(|d| Some(d.trim().to_string())).collect(),
+		None => vec![None],
+	};
+	if displays.len() > 1 && (opts.record.is_some() || opts.replay.is_some()) {
+		panic!("--record and --replay take a single display");
+	}
+	if opts.replay.is_none() {
+		for display in &displays {
+			if let Err(err) = check_backend(&opts, &config, display.as_deref()) {
+				panic!("{}", err);
+			}
 		}
+	}
+
+	// Only one instance per display, replays don't count
+	let mut controls = Vec::with_capacity(displays.len());
+	for display in &displays {
+		controls.push(match &opts.replay {
+			Some(_) => None,
+			None => match Control::bind(display.as_deref()) {
+				Ok(control) => Some(control),
+				Err(err) => panic!("{}", err),
+			},
+		});
+	}
 
-		// Select raw motion events
-		let mut mask = [0u8; (xinput2::XI_LASTEVENT as usize + 7) / 8]; // wtf?
-		xinput2::XISetMask(&mut mask, xinput2::XI_RawMotion);
+	// Helpers are forked before any thread or connection exists
+	let mut daemons: Vec<Daemon> = displays.iter().map(|display| new_daemon(&opts, &config, display.as_deref())).collect();
+	startup.mark("launcher");
 
-		let mut event_mask = xinput2::XIEventMask {
-			deviceid: xinput2::XIAllMasterDevices,
-			mask_len: mask.len() as i32,
-			mask: &mut mask[0] as *mut u8,
+	if let Some(path) = &opts.record {
+		daemons[0].recorder = match Recorder::create(path) {
+			Ok(recorder) => Some(recorder),
+			Err(err) => panic!("{}", err),
 		};
-		xinput2::XISelectEvents(display, window, &mut event_mask, 1);
+	}
+	daemons[0].stats.startup = startup;
 
-		// Get monitors
-		let mut nmonitors: i32 = 0;
-		let monitorinfo = xrandr::XRRGetMonitors(display, window, xlib::True, &mut nmonitors);
-		if monitorinfo.is_null() {
-			panic!("XRRGetMonitors failed");
+	unsafe {
+		// Catch signals
+		libc::signal(libc::SIGINT, sighandler as libc::sighandler_t);
+		libc::signal(libc::SIGTERM, sighandler as libc::sighandler_t);
+		if opts.config {
+			libc::signal(libc::SIGHUP, sighup as libc::sighandler_t);
+		} else {
+			libc::signal(libc::SIGHUP, sighandler as libc::sighandler_t);
 		}
+		libc::signal(libc::SIGUSR1, sigusr1 as libc::sighandler_t);
+		libc::signal(libc::SIGCHLD, sigchld as libc::sighandler_t);
+		libc::signal(libc::SIGPIPE, libc::SIG_IGN);
+	}
 
-		// prepare polling
-		let mut fds = libc::pollfd {
-			fd: xlib::XConnectionNumber(display),
-			events: libc::POLLIN,
-			revents: 0,
-		};
+	if let Some(path) = &opts.replay {
+		replay(&mut daemons[0], path, opts.replay_fast);
+		return;
+	}
 
-		// Main loop
+	let mut seats: Vec<Seat> = Vec::with_capacity(daemons.len());
+	for ((mut daemon, control), display) in daemons.into_iter().zip(controls).zip(&displays) {
+		let mut backend = new_backend(&opts, display.as_deref(), &mut daemon.stats.startup);
+		backend.set_zones(&daemon.config.zones);
+		seats.push(Seat { daemon, backend, control });
+	}
+
+	// Reload the config file on changes, keeping the X connection
+	let watch = if opts.config { Watch::new() } else { None };
+
+	let wakeup_fd = wakeup_pipe();
+
+	// prepare polling, the wakeup pipe and the watch, then the backend,
+	// launcher and control socket of each seat
+	let pollfd = |fd: i32| libc::pollfd { fd, events: libc::POLLIN, revents: 0 };
+	let mut fds = vec![pollfd(wakeup_fd), pollfd(watch.as_ref().map_or(-1, |w| w.fd()))];
+	for seat in &seats {
+		fds.push(pollfd(seat.backend.fd()));
+		fds.push(pollfd(seat.daemon.launcher.fd()));
+		fds.push(pollfd(seat.control.as_ref().map_or(-1, |c| c.fd())));
+	}
+
+	seats[0].daemon.stats.startup.mark("ready");
+
+	// Main loop
 
-		let mut oldx: i32 = 1;
-		let mut oldy: i32 = 1;
-		let mut xmax: i32 = 0;
-		let mut ymax: i32 = 0;
+	while RUNNING.load(Ordering::Relaxed) {
+		for seat in seats.iter_mut() {
+			seat.backend.dispatch(&mut seat.daemon);
+			seat.daemon.run_builtins(seat.backend.as_mut());
+		}
+
+		if !RUNNING.load(Ordering::Relaxed) {
+			break;
+		}
+
+		// Sleep until a backend, a signal, a dwell time, a cooldown or a sample wakes us up
+		let mut deadline: Option<Instant> = None;
+		let mut pending = false;
+		for (i, seat) in seats.iter_mut().enumerate() {
+			seat.daemon.tracer.flush();
+			pending |= seat.backend.pending();
 
-		while RUNNING.load(Ordering::Relaxed) {
-			if xlib::XPending(display) == 0 {
+			// A new command table restarts the helper, the executor starts on first use
+			fds[3 + 3 * i].fd = seat.daemon.launcher.fd();
+
+			for d in [seat.daemon.deadline(), seat.backend.deadline()].into_iter().flatten() {
+				deadline = Some(deadline.map_or(d, |t| t.min(d)));
+			}
+		}
+		let timeout = match deadline {
+			_ if pending => 0,
+			Some(t) => t.saturating_duration_since(Instant::now()).as_millis() as i32 + 1,
+			None => -1,
+		};
+
+		if unsafe { libc::poll(fds.as_mut_ptr(), fds.len() as libc::nfds_t, timeout) } < 0 {
+			if unsafe { *libc::__errno_location() } == libc::EINTR {
 				continue;
 			}
+			break;
+		}
+		let woke = Instant::now();
 
-			let event = {
-				let mut event = MaybeUninit::uninit();
-				xlib::XNextEvent(display, event.as_mut_ptr());
-				event.assume_init()
-			};
+		let children = fds[0].revents & libc::POLLIN != 0;
+		if children {
+			drain(wakeup_fd);
+		}
 
-			let mut cookie: xlib::XGenericEventCookie = event.generic_event_cookie;
-			xlib::XGetEventData(display, &mut cookie);
-
-			// Was pointer moved?
-			if cookie.type_ == xlib::GenericEvent &&
-			   cookie.extension == major_opcode &&
-			   cookie.evtype == xinput2::XI_RawMotion {
-
-				let mut root_ret: u64 = 0;
-				let mut child_ret: u64 = 0;
-				let mut x: i32 = 0;
-				let mut y: i32 = 0;
-				let mut winx_ret: i32 = 0;
-				let mut winy_ret: i32 = 0;
-				let mut mask_ret: u32 = 0;
-
-				xlib::XQueryPointer(display,
-						    window,
-						    &mut root_ret,
-						    &mut child_ret,
-						    &mut x,
-						    &mut y,
-						    &mut winx_ret,
-						    &mut winy_ret,
-						    &mut mask_ret);
-
-				// Now we have the position in x and y
-
-				if opts.debug {
-					println!("{} {}", x, y);
-				}
+		if fds[1].revents & libc::POLLIN != 0 && watch.as_ref().map_or(false, |w| w.changed()) {
+			RELOAD.store(true, Ordering::Relaxed);
+		}
 
-				get_xymax(x, y, &mut xmax, &mut ymax, display, nmonitors, monitorinfo);
+		for (i, seat) in seats.iter_mut().enumerate() {
+			let daemon = &mut seat.daemon;
+			daemon.woke = woke;
 
-				// Specifies the "hot" zones
-				let offset: i32 = ((ymax as f64) * 0.25) as i32;
+			if children || fds[3 + 3 * i].revents & libc::POLLIN != 0 {
+				daemon.reap();
+			}
 
-				// Make sure we run commands only once on edge hits
-				if (x == oldx && y == oldy) ||
-				   (x == oldx && y > offset && y < ymax - offset) ||
-				   (y == oldy && x > offset && x < xmax - offset) {
-					xlib::XFreeEventData(display, &mut cookie);
-					continue;
+			if fds[4 + 3 * i].revents & libc::POLLIN != 0 {
+				while let Some((mut stream, request)) = seat.control.as_mut().and_then(|c| c.accept()) {
+					daemon.tracer.record(Level::INFO, "control", &[("request", request.as_str().into())]);
+					let reply = match daemon.control(&request) {
+						Ok(reply) if reply.is_empty() => "ok\n".to_string(),
+						Ok(reply) => reply,
+						Err(err) => format!("error: {}\n", err),
+					};
+					let _ = stream.write_all(reply.as_bytes());
 				}
+			}
+		}
 
-				let edge = in_edge(x, y, xmax, ymax, offset);
-				if edge != Edge::NONE {
-					run(&opts, edge, &cmds);
+		if RELOAD.swap(false, Ordering::Relaxed) {
+			for seat in seats.iter_mut() {
+				let daemon = &mut seat.daemon;
+				match Config::load(&overrides, opts.config).and_then(|config| daemon.swap(config)) {
+					Ok(()) => {
+						seat.backend.set_zones(&daemon.config.zones);
+						daemon.tracer.record(Level::INFO, "reload", &[]);
+					}
+					Err(err) => {
+						let path = config::path();
+						daemon.tracer.record(Level::ERROR, "reload", &[("path", path.to_str().unwrap_or("").into()),
+											       ("error", err.as_str().into())]);
+					}
 				}
-
-				oldx = x;
-				oldy = y;
 			}
+		}
 
-			xlib::XFreeEventData(display, &mut cookie);
+		let dump = DUMP.swap(false, Ordering::Relaxed);
+		for (seat, display) in seats.iter_mut().zip(&displays) {
+			seat.daemon.expire(Instant::now());
+			seat.daemon.run_builtins(seat.backend.as_mut());
 
-			if libc::poll(&mut fds, 1, -1) < 0 {
-				break;
+			if dump {
+				if let Some(display) = display {
+					eprintln!("display              {}", display);
+				}
+				eprint!("{}", seat.daemon.stats.dump());
 			}
-		};
+		}
+	};
+
+	// Clean up
+	for seat in seats.iter_mut() {
+		if let Some(recorder) = &mut seat.daemon.recorder {
+			recorder.flush();
+		}
+	}
+	drop(seats);
+	unsafe {
+		libc::close(wakeup_fd);
+	}
+}
 
-		// Clean up
-		xrandr::XRRFreeMonitors(monitorinfo);
-		xlib::XCloseDisplay(display);
+// Builds the edge state for a display, with its own command table
+fn new_daemon(opts: &Opts, config: &Config, display: Option<&str>) -> Daemon
+{
+	// Rows per monitor are filled in with the first layout
+	let table = match config.actions(&[]) {
+		Ok(table) => table,
+		Err(err) => panic!("{}", err),
+	};
+
+	let mut launcher = Launcher::new(table, opts.block, display.map(|d| d.to_string()));
+	launcher.exclusive = config.exclusive;
+	if opts.warm {
+		launcher.warm();
 	}
+
+	// The writer thread starts with the first record, after all helpers are forked
+	let tracer = Tracer::new(if opts.debug { Level::TRACE } else { opts.log_level }, opts.log_format);
+
+	return Daemon {
+		tracer,
+		stats: Stats::new(),
+		trigger: Trigger::new(Duration::from_millis(config.dwell), config.rearm, config.push, config.max_velocity),
+		limiter: limiter(config),
+		launcher,
+		recorder: None,
+		config: config.clone(),
+		names: Vec::new(),
+		config_file: opts.config,
+		disabled: [false; 8],
+		builtins: Vec::with_capacity(8),
+		woke: Instant::now(),
+	};
+}
+
+// The backend of --backend, or evdev on Wayland and x11 otherwise
+fn backend_name<'a>(opts: &'a Opts, display: Option<&str>) -> &'a str
+{
+	// There is no global pointer query on Wayland, read the devices instead
+	let wayland = display.is_none() && env::var("WAYLAND_DISPLAY").is_ok();
+
+	return match opts.backend.as_deref() {
+		Some(name) => name,
+		None if wayland => "evdev",
+		None => "x11",
+	};
+}
+
+// Rejects options and commands the backend would ignore, before connecting
+fn check_backend(opts: &Opts, config: &Config, display: Option<&str>) -> Result<(), String>
+{
+	let name = backend_name(opts, display);
+	match name {
+		"x11" | "evdev" => {}
+		"xcb" if cfg!(feature = "xcb") => {}
+		"xcb" => return Err("the xcb backend needs a build with the xcb feature".to_string()),
+		other => return Err(format!("unknown backend: {}", other)),
+	}
+
+	let x11_only = |flag: &str| format!("{} needs the x11 backend, not {}", flag, name);
+	if name != "x11" {
+		if opts.barriers {
+			return Err(x11_only("--barriers"));
+		}
+		if opts.suspend_fullscreen {
+			return Err(x11_only("--suspend-fullscreen"));
+		}
+		if opts.sparse > 0 {
+			return Err(x11_only("--sparse"));
+		}
+
+		let commands = config.commands.iter().chain(config.monitors.iter().flat_map(|(_, c)| c.iter().flatten()));
+		if let Some(cmd) = commands.flatten().find(|cmd| matches!(Action::parse(cmd), Ok(Some(Action::Builtin(_))))) {
+			return Err(x11_only(cmd.split_whitespace().next().unwrap_or("@")));
+		}
+	}
+	if opts.sparse > 0 && opts.barriers {
+		return Err("--sparse doesn't work together with --barriers".to_string());
+	}
+	if name != "evdev" && opts.geometry.is_some() {
+		return Err(format!("--geometry needs the evdev backend, not {}", name));
+	}
+	if name == "evdev" && display.is_some() {
+		return Err("--display needs the x11 or xcb backend".to_string());
+	}
+
+	return Ok(());
+}
+
+fn new_backend(opts: &Opts, display: Option<&str>, startup: &mut Startup) -> Box<dyn Backend>
+{
+	return match backend_name(opts, display) {
+		#[cfg(feature = "xcb")]
+		"xcb" => Box::new(xcb::Xcb::new(display, opts.track, startup)),
+		"evdev" => Box::new(evdev_backend(opts)),
+		_ => Box::new(Xorg::new(display, opts.track, opts.barriers, opts.suspend_fullscreen, opts.sparse, startup)),
+	};
+}
+
+fn evdev_backend(opts: &Opts) -> Evdev
+{
+	// Monitors given by hand have no names
+	let (rects, names) = match &opts.geometry {
+		Some(geometry) => match evdev::parse_geometry(geometry) {
+			Ok(rects) => (rects, Vec::new()),
+			Err(err) => panic!("{}", err),
+		},
+		None => evdev::drm_geometry(),
+	};
+
+	return match Evdev::new(&rects, names) {
+		Ok(evdev) => evdev,
+		Err(err) => panic!("{}", err),
+	};
 }
@@ -0,0 +1,204 @@
+// Recording and replaying of pointer traces
+//
+// A trace starts with a header, followed by records:
+//   'L' generation:u16 count:u16 (x:i32 y:i32 w:i32 h:i32)*count
+//   'M' time:u64 x:i16 y:i16 generation:u16 dx:f32 dy:f32
+// All values are little endian, times are microseconds since the start.
+// X coordinates are 16 bit on the wire, so they fit. Version 1 traces
+// have no deltas and replay with 0.
+
+use std::fs::File;
+use std::io::BufReader;
+use std::io::BufWriter;
+use std::io::Read;
+use std::io::Write;
+use std::path::Path;
+use std::time::Instant;
+use crate::layout::Rect;
+
+const MAGIC: &[u8; 4] = b"EDGR";
+const VERSION: u8 = 2;
+
+#[derive(Debug, Clone, PartialEq)]
+pub enum Record {
+	// Monitor setup, motions refer to it by generation
+	LAYOUT(u16, Vec<Rect>),
+	MOTION { time: u64, x: i32, y: i32, generation: u16, delta: (f64, f64) },
+}
+
+pub struct Recorder {
+	out: BufWriter<File>,
+	start: Instant,
+	generation: u16,
+}
+
+impl Recorder {
+	pub fn create(path: &Path) -> Result<Recorder, String>
+	{
+		let file = File::create(path).map_err(|e| format!("{}: {}", path.display(), e))?;
+		let mut out = BufWriter::with_capacity(1 << 16, file);
+
+		out.write_all(MAGIC).and_then(|_| out.write_all(&[VERSION])).map_err(|e| e.to_string())?;
+
+		return Ok(Recorder { out, start: Instant::now(), generation: 0 });
+	}
+
+	// Starts a new monitor config generation
+	pub fn layout(&mut self, rects: &[Rect])
+	{
+		self.generation = self.generation.wrapping_add(1);
+
+		let mut buf = Vec::with_capacity(5 + rects.len() * 16);
+		buf.push(b'L');
+		buf.extend_from_slice(&self.generation.to_le_bytes());
+		buf.extend_from_slice(&(rects.len().min(u16::MAX as usize) as u16).to_le_bytes());
+		for r in rects.iter().take(u16::MAX as usize) {
+			for v in [r.x, r.y, r.w, r.h] {
+				buf.extend_from_slice(&v.to_le_bytes());
+			}
+		}
+
+		let _ = self.out.write_all(&buf);
+	}
+
+	pub fn motion(&mut self, x: i32, y: i32, delta: (f64, f64), now: Instant)
+	{
+		let time = now.saturating_duration_since(self.start).as_micros() as u64;
+
+		let mut buf = [0u8; 23];
+		buf[0] = b'M';
+		buf[1..9].copy_from_slice(&time.to_le_bytes());
+		buf[9..11].copy_from_slice(&(x as i16).to_le_bytes());
+		buf[11..13].copy_from_slice(&(y as i16).to_le_bytes());
+		buf[13..15].copy_from_slice(&self.generation.to_le_bytes());
+		buf[15..19].copy_from_slice(&(delta.0 as f32).to_le_bytes());
+		buf[19..23].copy_from_slice(&(delta.1 as f32).to_le_bytes());
+
+		let _ = self.out.write_all(&buf);
+	}
+
+	pub fn flush(&mut self)
+	{
+		let _ = self.out.flush();
+	}
+}
+
+pub struct Player {
+	input: BufReader<File>,
+	version: u8,
+}
+
+impl Player {
+	pub fn open(path: &Path) -> Result<Player, String>
+	{
+		let file = File::open(path).map_err(|e| format!("{}: {}", path.display(), e))?;
+		let mut input = BufReader::with_capacity(1 << 16, file);
+
+		let mut header = [0u8; 5];
+		input.read_exact(&mut header).map_err(|_| format!("{}: not a trace", path.display()))?;
+		if &header[0..4] != MAGIC || header[4] == 0 || header[4] > VERSION {
+			return Err(format!("{}: not a trace", path.display()));
+		}
+
+		return Ok(Player { input, version: header[4] });
+	}
+
+	fn read<const N: usize>(&mut self) -> Option<[u8; N]>
+	{
+		let mut buf = [0u8; N];
+		self.input.read_exact(&mut buf).ok()?;
+
+		return Some(buf);
+	}
+
+	// Returns the next record, None at the end or on a truncated record
+	pub fn next(&mut self) -> Option<Record>
+	{
+		let [tag] = self.read::<1>()?;
+
+		match tag {
+			b'L' => {
+				let generation = u16::from_le_bytes(self.read::<2>()?);
+				let count = u16::from_le_bytes(self.read::<2>()?);
+				let mut rects = Vec::with_capacity(count as usize);
+				for _ in 0..count {
+					let b = self.read::<16>()?;
+					let v = |i: usize| i32::from_le_bytes([b[i], b[i + 1], b[i + 2], b[i + 3]]);
+					rects.push(Rect { x: v(0), y: v(4), w: v(8), h: v(12) });
+				}
+				return Some(Record::LAYOUT(generation, rects));
+			}
+			b'M' => {
+				let b = self.read::<14>()?;
+				let time = u64::from_le_bytes([b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7]]);
+				let x = i16::from_le_bytes([b[8], b[9]]) as i32;
+				let y = i16::from_le_bytes([b[10], b[11]]) as i32;
+				let generation = u16::from_le_bytes([b[12], b[13]]);
+				let delta = if self.version >= 2 {
+					let d = self.read::<8>()?;
+					(f32::from_le_bytes([d[0], d[1], d[2], d[3]]) as f64,
+					 f32::from_le_bytes([d[4], d[5], d[6], d[7]]) as f64)
+				} else {
+					(0.0, 0.0)
+				};
+				return Some(Record::MOTION { time, x, y, generation, delta });
+			}
+			_ => return None,
+		}
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+	use std::path::PathBuf;
+	use std::time::Duration;
+
+	fn temp(name: &str) -> PathBuf
+	{
+		return std::env::temp_dir().join(format!("edges-{}-{}", std::process::id(), name));
+	}
+
+	#[test]
+	fn round_trip()
+	{
+		let path = temp("v2");
+		let rects = vec![Rect { x: 0, y: 0, w: 1920, h: 1080 }, Rect { x: 1920, y: -200, w: 1080, h: 1920 }];
+
+		let mut recorder = Recorder::create(&path).unwrap();
+		let start = recorder.start;
+		recorder.layout(&rects);
+		recorder.motion(10, -20, (1.5, -2.0), start + Duration::from_micros(1234));
+		recorder.flush();
+		drop(recorder);
+
+		let mut player = Player::open(&path).unwrap();
+		assert_eq!(player.next(), Some(Record::LAYOUT(1, rects)));
+		assert_eq!(player.next(), Some(Record::MOTION { time: 1234, x: 10, y: -20, generation: 1, delta: (1.5, -2.0) }));
+		assert_eq!(player.next(), None);
+		let _ = std::fs::remove_file(&path);
+	}
+
+	#[test]
+	fn version_1_has_no_deltas()
+	{
+		let path = temp("v1");
+		let mut buf = b"EDGR\x01".to_vec();
+		buf.push(b'M');
+		buf.extend_from_slice(&7u64.to_le_bytes());
+		buf.extend_from_slice(&5i16.to_le_bytes());
+		buf.extend_from_slice(&6i16.to_le_bytes());
+		buf.extend_from_slice(&3u16.to_le_bytes());
+		// Truncated record
+		buf.push(b'M');
+		std::fs::write(&path, &buf).unwrap();
+
+		let mut player = Player::open(&path).unwrap();
+		assert_eq!(player.next(), Some(Record::MOTION { time: 7, x: 5, y: 6, generation: 3, delta: (0.0, 0.0) }));
+		assert_eq!(player.next(), None);
+
+		std::fs::write(&path, b"EDGR\x09").unwrap();
+		assert!(Player::open(&path).is_err());
+		let _ = std::fs::remove_file(&path);
+	}
+}
@@ -0,0 +1,1011 @@
+// Launching of edge commands
+
+use std::env;
+use std::ffi::CString;
+use std::ffi::OsStr;
+use std::ffi::OsString;
+use std::fmt;
+use std::io::Write;
+use std::os::unix::ffi::OsStrExt;
+use std::os::unix::ffi::OsStringExt;
+use std::os::unix::fs::FileTypeExt;
+use std::os::unix::fs::OpenOptionsExt;
+use std::os::unix::net::UnixStream;
+use std::path::Path;
+use std::path::PathBuf;
+use std::ptr;
+use std::sync::Arc;
+use std::time::Duration;
+use std::time::Instant;
+use crate::exec::Executor;
+use crate::layout::Edge;
+
+extern "C" {
+	static environ: *const *mut libc::c_char;
+}
+
+pub enum Action {
+	// Spawn a program, the path is resolved and argv is built at load time
+	Exec { path: CString, args: Vec<CString>, argv: Vec<*mut libc::c_char> },
+	// Write a message to a FIFO or Unix socket of a running handler
+	Send { path: PathBuf, message: Vec<u8> },
+	// Done by the backend over its display connection
+	Builtin(Builtin),
+}
+
+// argv only points into args, which never change after parsing, so the
+// table can be shared with the executor thread
+unsafe impl Send for Action {}
+unsafe impl Sync for Action {}
+
+// Actions that need no process, "@NAME [ARGS]" in commands
+#[derive(Debug, Clone, PartialEq)]
+pub enum Builtin {
+	// Press and release a chord of keysyms, like super or ctrl+alt+t
+	KEY(Vec<String>),
+	// Toggle _NET_SHOWING_DESKTOP
+	SHOWDESKTOP,
+	DPMSOFF,
+	// Switch to a workspace by index, or by offset if relative
+	WORKSPACE(i64, bool),
+}
+
+// Short names of the modifiers for @key, other keys are keysym names
+const KEY_ALIASES: [(&str, &str); 6] = [
+	("super", "Super_L"),
+	("ctrl", "Control_L"),
+	("control", "Control_L"),
+	("alt", "Alt_L"),
+	("shift", "Shift_L"),
+	("meta", "Meta_L"),
+];
+
+fn keysym_name(key: &str) -> String
+{
+	return match KEY_ALIASES.iter().find(|(alias, _)| alias.eq_ignore_ascii_case(key)) {
+		Some((_, name)) => name.to_string(),
+		None => key.to_string(),
+	};
+}
+
+impl Builtin {
+	fn parse(words: &[String]) -> Result<Builtin, String>
+	{
+		let arg = words.get(1).map(|s| s.as_str());
+		if words.len() > 2 {
+			return Err(format!("{}: too many arguments", words.join(" ")));
+		}
+
+		return match (words[0].as_str(), arg) {
+			("@key", Some(chord)) => Ok(Builtin::KEY(chord.split('+').map(keysym_name).collect())),
+			("@showdesktop", None) => Ok(Builtin::SHOWDESKTOP),
+			("@dpms-off", None) => Ok(Builtin::DPMSOFF),
+			("@workspace", Some("next")) => Ok(Builtin::WORKSPACE(1, true)),
+			("@workspace", Some("prev")) => Ok(Builtin::WORKSPACE(-1, true)),
+			("@workspace", Some(n)) => match n.parse::<i64>() {
+				Ok(n) => Ok(Builtin::WORKSPACE(n, false)),
+				Err(_) => Err(format!("{}: invalid workspace", words.join(" "))),
+			},
+			_ => Err(format!("{}: unknown builtin", words.join(" "))),
+		};
+	}
+}
+
+impl fmt::Debug for Action {
+	fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result
+	{
+		return match self {
+			Action::Exec { path, args, .. } => write!(f, "Exec {:?} {:?}", path, args),
+			Action::Send { path, message } => write!(f, "Send {:?} {:?}", path, String::from_utf8_lossy(message)),
+			Action::Builtin(builtin) => write!(f, "Builtin {:?}", builtin),
+		};
+	}
+}
+
+// argv points into args and is rebuilt for the copy
+impl Clone for Action {
+	fn clone(&self) -> Action
+	{
+		return match self {
+			Action::Exec { path, args, .. } => {
+				let args = args.clone();
+				let mut argv: Vec<*mut libc::c_char> = args.iter().map(|a| a.as_ptr() as *mut libc::c_char).collect();
+				argv.push(ptr::null_mut());
+				Action::Exec { path: path.clone(), args, argv }
+			}
+			Action::Send { path, message } => Action::Send { path: path.clone(), message: message.clone() },
+			Action::Builtin(builtin) => Action::Builtin(builtin.clone()),
+		};
+	}
+}
+
+impl Action {
+	// Parses a command, "> PATH [MESSAGE]" sends to a handler and
+	// "@NAME [ARGS]" is a builtin. Returns None for empty commands.
+	pub fn parse(cmd: &str) -> Result<Option<Action>, String>
+	{
+		let mut words = split(cmd)?;
+		if words.is_empty() {
+			return Ok(None);
+		}
+
+		if words[0].starts_with('@') {
+			return Ok(Some(Action::Builtin(Builtin::parse(&words)?)));
+		}
+
+		if let Some(path) = words[0].strip_prefix('>') {
+			let path = if path.is_empty() && words.len() > 1 { words.remove(1) } else { path.to_string() };
+			if path.is_empty() {
+				return Err(format!("{}: missing path", cmd));
+			}
+
+			let mut message = words[1..].join(" ").into_bytes();
+			message.push(b'\n');
+
+			return Ok(Some(Action::Send { path: PathBuf::from(path), message }));
+		}
+
+		let path = match resolve(&words[0]) {
+			Some(path) => path.into_os_string().into_vec(),
+			None => words[0].clone().into_bytes(),
+		};
+
+		let path = CString::new(path).map_err(|_| format!("{}: invalid command", cmd))?;
+		let args = words.into_iter()
+			.map(CString::new)
+			.collect::<Result<Vec<CString>, _>>()
+			.map_err(|_| format!("{}: invalid command", cmd))?;
+
+		// The strings are owned by args, moving the vector keeps them in place
+		let mut argv: Vec<*mut libc::c_char> = args.iter().map(|a| a.as_ptr() as *mut libc::c_char).collect();
+		argv.push(ptr::null_mut());
+
+		return Ok(Some(Action::Exec { path, args, argv }));
+	}
+}
+
+// Splits a command into words like a shell does, without expansions.
+// Single quotes preserve everything, in double quotes a backslash escapes
+// the characters a shell would handle there.
+fn split(cmd: &str) -> Result<Vec<String>, String>
+{
+	let mut words = Vec::new();
+	let mut word = String::new();
+	let mut in_word = false;
+	let mut chars = cmd.chars();
+
+	while let Some(c) = chars.next() {
+		match c {
+			'\'' => {
+				in_word = true;
+				loop {
+					match chars.next() {
+						Some('\'') => break,
+						Some(c) => word.push(c),
+						None => return Err(format!("{}: unterminated quote", cmd)),
+					}
+				}
+			}
+			'"' => {
+				in_word = true;
+				loop {
+					match chars.next() {
+						Some('"') => break,
+						Some('\\') => match chars.next() {
+							Some(c) if "\\\"$`".contains(c) => word.push(c),
+							Some('\n') => {}
+							Some(c) => { word.push('\\'); word.push(c); }
+							None => return Err(format!("{}: unterminated quote", cmd)),
+						},
+						Some(c) => word.push(c),
+						None => return Err(format!("{}: unterminated quote", cmd)),
+					}
+				}
+			}
+			'\\' => {
+				in_word = true;
+				match chars.next() {
+					Some('\n') => {}
+					Some(c) => word.push(c),
+					None => word.push('\\'),
+				}
+			}
+			c if c.is_whitespace() => {
+				if in_word {
+					words.push(std::mem::take(&mut word));
+					in_word = false;
+				}
+			}
+			c => {
+				in_word = true;
+				word.push(c);
+			}
+		}
+	}
+
+	if in_word {
+		words.push(word);
+	}
+
+	return Ok(words);
+}
+
+// Looks up a program in PATH once, instead of on every launch
+fn resolve(name: &str) -> Option<PathBuf>
+{
+	if name.contains('/') {
+		return Some(PathBuf::from(name));
+	}
+
+	return search(name, &env::var_os("PATH")?);
+}
+
+fn search(name: &str, paths: &OsStr) -> Option<PathBuf>
+{
+	for dir in env::split_paths(paths) {
+		let path = if dir.as_os_str().is_empty() { Path::new(".").join(name) } else { dir.join(name) };
+		// Entries that aren't valid C strings can't hold it
+		let c_path = match CString::new(path.as_os_str().as_bytes()) {
+			Ok(c_path) => c_path,
+			Err(_) => continue,
+		};
+
+		if path.is_file() && unsafe { libc::access(c_path.as_ptr(), libc::X_OK) } == 0 {
+			return Some(path);
+		}
+	}
+
+	return None;
+}
+
+// Spawn attributes, built once. Children start with default signal
+// handling whatever the daemon ignores or blocks. For a display other
+// than the one of the daemon they get their own environment.
+pub struct SpawnAttr(libc::posix_spawnattr_t, Option<(Vec<CString>, Vec<*mut libc::c_char>)>);
+
+// The environment for children on the display
+fn display_env(display: &str) -> (Vec<CString>, Vec<*mut libc::c_char>)
+{
+	let mut vars: Vec<CString> = env::vars_os()
+		.filter(|(k, _)| k != "DISPLAY")
+		.filter_map(|(k, v)| {
+			let mut var = k.into_string().ok()?;
+			var.push('=');
+			var.push_str(v.to_str()?);
+			return CString::new(var).ok();
+		})
+		.collect();
+	if let Ok(var) = CString::new(format!("DISPLAY={}", display)) {
+		vars.push(var);
+	}
+
+	let mut envp: Vec<*mut libc::c_char> = vars.iter().map(|v| v.as_ptr() as *mut libc::c_char).collect();
+	envp.push(ptr::null_mut());
+
+	return (vars, envp);
+}
+
+impl SpawnAttr {
+	pub fn new(display: Option<&str>) -> SpawnAttr
+	{
+		let env = display.map(display_env);
+
+		unsafe {
+			let mut attr = std::mem::MaybeUninit::<libc::posix_spawnattr_t>::uninit();
+			let mut sigdefault = std::mem::MaybeUninit::<libc::sigset_t>::uninit();
+			let mut sigmask = std::mem::MaybeUninit::<libc::sigset_t>::uninit();
+
+			libc::posix_spawnattr_init(attr.as_mut_ptr());
+			libc::sigemptyset(sigdefault.as_mut_ptr());
+			// Every signal the daemon or the helper handles or ignores
+			for signal in [libc::SIGINT, libc::SIGTERM, libc::SIGHUP, libc::SIGUSR1, libc::SIGCHLD, libc::SIGPIPE] {
+				libc::sigaddset(sigdefault.as_mut_ptr(), signal);
+			}
+			libc::sigemptyset(sigmask.as_mut_ptr());
+			libc::posix_spawnattr_setsigdefault(attr.as_mut_ptr(), sigdefault.as_ptr());
+			libc::posix_spawnattr_setsigmask(attr.as_mut_ptr(), sigmask.as_ptr());
+			libc::posix_spawnattr_setflags(attr.as_mut_ptr(), (libc::POSIX_SPAWN_SETSIGDEF | libc::POSIX_SPAWN_SETSIGMASK) as libc::c_short);
+
+			return SpawnAttr(attr.assume_init(), env);
+		}
+	}
+}
+
+impl Drop for SpawnAttr {
+	fn drop(&mut self)
+	{
+		unsafe {
+			libc::posix_spawnattr_destroy(&mut self.0);
+		}
+	}
+}
+
+// Spawns a program, glibc uses vfork semantics so the page tables of
+// the caller are not copied
+fn spawn(path: &CString, argv: &[*mut libc::c_char], attr: &SpawnAttr) -> Result<libc::pid_t, i32>
+{
+	let mut pid: libc::pid_t = 0;
+
+	let ret = unsafe {
+		let envp = match &attr.1 {
+			Some((_, envp)) => envp.as_ptr(),
+			None => environ,
+		};
+		libc::posix_spawn(&mut pid, path.as_ptr(), ptr::null(), &attr.0, argv.as_ptr(), envp)
+	};
+
+	if ret != 0 {
+		return Err(ret);
+	}
+	return Ok(pid);
+}
+
+fn send(path: &Path, message: &[u8]) -> std::io::Result<()>
+{
+	let is_socket = std::fs::metadata(path)?.file_type().is_socket();
+
+	if is_socket {
+		let mut stream = UnixStream::connect(path)?;
+		return stream.write_all(message);
+	}
+
+	// Never block on a FIFO without reader
+	let mut fifo = std::fs::OpenOptions::new()
+		.write(true)
+		.custom_flags(libc::O_NONBLOCK)
+		.open(path)?;
+
+	return fifo.write_all(message);
+}
+
+// Starts an action, returns the pid if a process is still running. It
+// runs off the loop thread or in the helper, so errors are returned as
+// errno to be reported by the loop.
+pub fn launch(action: &Action, attr: &SpawnAttr) -> Result<Option<libc::pid_t>, i32>
+{
+	return match action {
+		Action::Exec { path, argv, .. } => spawn(path, argv, attr).map(Some),
+		Action::Send { path, message } => match send(path, message) {
+			Ok(()) => Ok(None),
+			Err(err) => Err(err.raw_os_error().unwrap_or(libc::EIO)),
+		},
+		Action::Builtin(_) => Ok(None),
+	};
+}
+
+// Reaps exited children, calls back with the slots they were started
+// for. Only our own children are waited for, other launchers in the
+// process have theirs.
+fn reap_children(children: &mut Vec<(libc::pid_t, usize)>, mut exited: impl FnMut(usize))
+{
+	let mut i = 0;
+
+	while i < children.len() {
+		let (pid, slot) = children[i];
+		if unsafe { libc::waitpid(pid, ptr::null_mut(), libc::WNOHANG) } != 0 {
+			children.swap_remove(i);
+			exited(slot);
+		} else {
+			i += 1;
+		}
+	}
+}
+
+// Slots past the table are of rows removed while the command ran
+fn finished(running: &mut Vec<u32>, slot: usize)
+{
+	if let Some(n) = running.get_mut(slot) {
+		*n = n.saturating_sub(1);
+	}
+}
+
+// Replies of the helper, the slot, the errno of the launch and the spawn
+// time in microseconds, or FINISHED once the command exited. Writes this
+// small are atomic.
+const FINISHED: i32 = -1;
+
+fn read_reply(fd: i32) -> Option<(usize, i32, Duration)>
+{
+	let mut reply = [0u32; 3];
+
+	if unsafe { libc::read(fd, reply.as_mut_ptr() as *mut libc::c_void, 12) } == 12 {
+		return Some((reply[0] as usize, reply[1] as i32, Duration::from_micros(reply[2] as u64)));
+	}
+	return None;
+}
+
+fn write_reply(fd: i32, slot: usize, status: i32, time: Duration)
+{
+	let reply = [slot as u32, status as u32, time.as_micros().min(u32::MAX as u128) as u32];
+
+	unsafe {
+		libc::write(fd, reply.as_ptr() as *const libc::c_void, 12);
+	}
+}
+
+// Slots are sent through pipes, writes this small are atomic
+fn read_slot(fd: i32) -> Option<usize>
+{
+	let mut slot: u32 = 0;
+
+	if unsafe { libc::read(fd, &mut slot as *mut u32 as *mut libc::c_void, 4) } == 4 {
+		return Some(slot as usize);
+	}
+	return None;
+}
+
+fn write_slot(fd: i32, slot: usize) -> bool
+{
+	let slot = slot as u32;
+
+	return unsafe { libc::write(fd, &slot as *const u32 as *const libc::c_void, 4) } == 4;
+}
+
+fn write_all(fd: i32, mut buf: &[u8]) -> bool
+{
+	while !buf.is_empty() {
+		let n = unsafe { libc::write(fd, buf.as_ptr() as *const libc::c_void, buf.len()) };
+		if n <= 0 {
+			return false;
+		}
+		buf = &buf[n as usize..];
+	}
+
+	return true;
+}
+
+fn read_exact(fd: i32, buf: &mut [u8]) -> bool
+{
+	let mut done = 0;
+
+	while done < buf.len() {
+		let n = unsafe { libc::read(fd, buf[done..].as_mut_ptr() as *mut libc::c_void, buf.len() - done) };
+		if n <= 0 {
+			return false;
+		}
+		done += n as usize;
+	}
+
+	return true;
+}
+
+// Request to the helper that is followed by a new command table
+const TABLE: usize = u32::MAX as usize;
+
+// Serializes a table for the helper, the length comes first. Builtins
+// are never sent to the helper and go as empty slots.
+fn encode(table: &Table) -> Vec<u8>
+{
+	let mut buf = vec![0u8; 4];
+	let field = |buf: &mut Vec<u8>, bytes: &[u8]| {
+		buf.extend_from_slice(&(bytes.len() as u32).to_ne_bytes());
+		buf.extend_from_slice(bytes);
+	};
+
+	for action in table.iter().flatten() {
+		match action {
+			Some(Action::Exec { path, args, .. }) => {
+				buf.push(1);
+				field(&mut buf, path.as_bytes());
+				buf.extend_from_slice(&(args.len() as u32).to_ne_bytes());
+				for arg in args {
+					field(&mut buf, arg.as_bytes());
+				}
+			}
+			Some(Action::Send { path, message }) => {
+				buf.push(2);
+				field(&mut buf, path.as_os_str().as_bytes());
+				field(&mut buf, message);
+			}
+			Some(Action::Builtin(_)) | None => buf.push(0),
+		}
+	}
+
+	let len = (buf.len() - 4) as u32;
+	buf[..4].copy_from_slice(&len.to_ne_bytes());
+
+	return buf;
+}
+
+// Reads the fields written by encode
+struct Fields<'a>(&'a [u8]);
+
+impl<'a> Fields<'a> {
+	fn take(&mut self, n: usize) -> Option<&'a [u8]>
+	{
+		if self.0.len() < n {
+			return None;
+		}
+		let (a, b) = self.0.split_at(n);
+		self.0 = b;
+
+		return Some(a);
+	}
+
+	fn count(&mut self) -> Option<usize>
+	{
+		return Some(u32::from_ne_bytes(self.take(4)?.try_into().ok()?) as usize);
+	}
+
+	fn bytes(&mut self) -> Option<Vec<u8>>
+	{
+		let len = self.count()?;
+
+		return Some(self.take(len)?.to_vec());
+	}
+}
+
+fn decode(buf: &[u8]) -> Option<Table>
+{
+	let mut fields = Fields(buf);
+	let mut slots: Vec<Option<Action>> = Vec::new();
+
+	while let Some(kind) = fields.take(1) {
+		slots.push(match kind[0] {
+			1 => {
+				let path = CString::new(fields.bytes()?).ok()?;
+				let count = fields.count()?;
+				let args = (0..count).map(|_| CString::new(fields.bytes()?).ok()).collect::<Option<Vec<CString>>>()?;
+				let mut argv: Vec<*mut libc::c_char> = args.iter().map(|a| a.as_ptr() as *mut libc::c_char).collect();
+				argv.push(ptr::null_mut());
+				Some(Action::Exec { path, args, argv })
+			}
+			2 => {
+				let path = PathBuf::from(OsString::from_vec(fields.bytes()?));
+				Some(Action::Send { path, message: fields.bytes()? })
+			}
+			_ => None,
+		});
+	}
+
+	if slots.len() % 8 != 0 {
+		return None;
+	}
+
+	let mut table: Table = Vec::with_capacity(slots.len() / 8);
+	let mut slots = slots.into_iter();
+	while let Some(first) = slots.next() {
+		table.push([first, slots.next()?, slots.next()?, slots.next()?,
+			    slots.next()?, slots.next()?, slots.next()?, slots.next()?]);
+	}
+
+	return Some(table);
+}
+
+fn read_table(fd: i32) -> Option<Table>
+{
+	let mut len = [0u8; 4];
+	if !read_exact(fd, &mut len) {
+		return None;
+	}
+
+	let mut buf = vec![0u8; u32::from_ne_bytes(len) as usize];
+	if !read_exact(fd, &mut buf) {
+		return None;
+	}
+
+	return decode(&buf);
+}
+
+// Command table with a row of eight edges per monitor, a single row
+// applies to all monitors
+pub type Table = Vec<[Option<Action>; 8]>;
+
+pub struct Launcher {
+	table: Arc<Table>,
+	attr: SpawnAttr,
+
+	// Don't refire an edge until its command exited
+	pub block: bool,
+
+	// Don't launch while the previous command of the edge still runs
+	pub exclusive: [bool; 8],
+
+	// Running children and their count per slot of the table
+	children: Vec<(libc::pid_t, usize)>,
+	running: Vec<u32>,
+
+	// Pipes to the pre-forked helper in warm mode
+	helper: Option<(libc::pid_t, i32, i32)>,
+
+	// Launches commands otherwise, started on first use
+	executor: Option<Executor>,
+
+	// Display the commands are for, None for the one of the daemon
+	display: Option<String>,
+}
+
+impl Launcher {
+	pub fn new(table: Table, block: bool, display: Option<String>) -> Launcher
+	{
+		let running = vec![0; table.len() * 8];
+
+		return Launcher {
+			table: Arc::new(table),
+			attr: SpawnAttr::new(display.as_deref()),
+			block,
+			exclusive: [false; 8],
+			children: Vec::with_capacity(16),
+			running,
+			helper: None,
+			executor: None,
+			display,
+		};
+	}
+
+	fn slot(&self, monitor: usize, edge: Edge) -> usize
+	{
+		let row = if monitor < self.table.len() { monitor } else { 0 };
+
+		return row * 8 + edge as usize;
+	}
+
+	fn get(&self, slot: usize) -> Option<&Action>
+	{
+		return self.table.get(slot / 8)?.get(slot % 8)?.as_ref();
+	}
+
+	pub fn action(&self, monitor: usize, edge: Edge) -> Option<&Action>
+	{
+		return self.get(self.slot(monitor, edge));
+	}
+
+	pub fn running(&self, monitor: usize, edge: Edge) -> bool
+	{
+		return self.running[self.slot(monitor, edge)] > 0;
+	}
+
+	// Returns the fd to poll for finished commands of the helper, or for
+	// commands started by the executor
+	pub fn fd(&self) -> i32
+	{
+		return match (&self.helper, &self.executor) {
+			(Some((_, _, reply)), _) => *reply,
+			(None, Some(executor)) => executor.fd(),
+			(None, None) => -1,
+		};
+	}
+
+	// Swaps in a new command table, a running helper gets a copy of it.
+	// The table is swapped even if the helper is gone.
+	pub fn set_actions(&mut self, table: Table, exclusive: [bool; 8]) -> Result<(), &'static str>
+	{
+		// Running commands are still reaped. Slots are row * 8 + edge in
+		// any shape, those of rows that are gone are no longer counted.
+		self.running.resize(table.len() * 8, 0);
+
+		let sent = match self.helper {
+			Some((_, request, _)) => write_slot(request, TABLE) && write_all(request, &encode(&table)),
+			None => true,
+		};
+
+		self.table = Arc::new(table);
+		self.exclusive = exclusive;
+
+		if !sent {
+			return Err("helper failed");
+		}
+		return Ok(());
+	}
+
+	fn stop_helper(&mut self)
+	{
+		// The helper exits once its request pipe is closed, helpers of
+		// other displays forked later hold a copy of it
+		if let Some((pid, request, reply)) = self.helper.take() {
+			unsafe {
+				libc::close(request);
+				libc::close(reply);
+				libc::kill(pid, libc::SIGTERM);
+				libc::waitpid(pid, ptr::null_mut(), 0);
+			}
+		}
+	}
+
+	// Forks a small helper that launches commands on request. It is
+	// forked once, before the X connection is opened and before any
+	// thread runs, so launches start from a tiny address space. Later
+	// command tables are sent to it instead of forking again.
+	//
+	// For every request the helper replies with the result of the launch,
+	// and with the slot once the command finished.
+	pub fn warm(&mut self)
+	{
+		let mut request = [-1i32; 2];
+		let mut reply = [-1i32; 2];
+
+		unsafe {
+			if libc::pipe2(request.as_mut_ptr(), libc::O_CLOEXEC) < 0 ||
+			   libc::pipe2(reply.as_mut_ptr(), libc::O_CLOEXEC) < 0 {
+				panic!("pipe2 failed");
+			}
+
+			let pid = libc::fork();
+			if pid < 0 {
+				panic!("fork failed");
+			}
+
+			if pid == 0 {
+				libc::close(request[1]);
+				libc::close(reply[0]);
+				self.helper_loop(request[0], reply[1]);
+				libc::_exit(0);
+			}
+
+			libc::close(request[0]);
+			libc::close(reply[1]);
+			libc::fcntl(reply[0], libc::F_SETFL, libc::O_NONBLOCK);
+			self.helper = Some((pid, request[1], reply[0]));
+		}
+	}
+
+	fn helper_loop(&mut self, request: i32, reply: i32)
+	{
+		unsafe {
+			// Signals are meant for the parent
+			libc::signal(libc::SIGINT, libc::SIG_IGN);
+			libc::signal(libc::SIGHUP, libc::SIG_IGN);
+
+			// Wait for children through a signalfd along with the requests
+			let mut mask = std::mem::MaybeUninit::<libc::sigset_t>::uninit();
+			libc::sigemptyset(mask.as_mut_ptr());
+			libc::sigaddset(mask.as_mut_ptr(), libc::SIGCHLD);
+			libc::sigprocmask(libc::SIG_BLOCK, mask.as_ptr(), ptr::null_mut());
+			let sfd = libc::signalfd(-1, mask.as_ptr(), libc::SFD_NONBLOCK | libc::SFD_CLOEXEC);
+
+			let mut fds = [
+				libc::pollfd { fd: request, events: libc::POLLIN, revents: 0 },
+				libc::pollfd { fd: sfd, events: libc::POLLIN, revents: 0 },
+			];
+
+			loop {
+				if libc::poll(fds.as_mut_ptr(), fds.len() as libc::nfds_t, -1) < 0 {
+					continue;
+				}
+
+				if fds[1].revents & libc::POLLIN != 0 {
+					let mut info = std::mem::MaybeUninit::<libc::signalfd_siginfo>::uninit();
+					while libc::read(sfd, info.as_mut_ptr() as *mut libc::c_void,
+							 std::mem::size_of::<libc::signalfd_siginfo>()) > 0 {}
+
+					reap_children(&mut self.children, |slot| write_reply(reply, slot, FINISHED, Duration::ZERO));
+				}
+
+				if fds[0].revents & (libc::POLLIN | libc::POLLHUP) != 0 {
+					let slot = match read_slot(request) {
+						Some(TABLE) => match read_table(request) {
+							Some(table) => {
+								self.table = Arc::new(table);
+								continue;
+							}
+							None => break,
+						},
+						Some(slot) => slot,
+						None => break,
+					};
+
+					let start = Instant::now();
+					let launched = self.get(slot).map_or(Ok(None), |action| launch(action, &self.attr));
+					write_reply(reply, slot, launched.err().unwrap_or(0), start.elapsed());
+					match launched {
+						Ok(Some(pid)) => self.children.push((pid, slot)),
+						_ => write_reply(reply, slot, FINISHED, Duration::ZERO),
+					}
+				}
+			}
+		}
+	}
+
+	// Updates the running commands, call when woken by SIGCHLD, the helper
+	// or the executor. Calls back with the slot, the spawn time and the
+	// errno, 0 if it succeeded, of every launch.
+	pub fn reap(&mut self, mut launched: impl FnMut(usize, Duration, i32))
+	{
+		let running = &mut self.running;
+		let children = &mut self.children;
+
+		if let Some((_, _, reply)) = self.helper {
+			while let Some((slot, status, time)) = read_reply(reply) {
+				match status {
+					FINISHED => finished(running, slot),
+					errno => launched(slot, time, errno),
+				}
+			}
+			return;
+		}
+
+		if let Some(executor) = &self.executor {
+			executor.started(|result, slot, time| {
+				launched(slot, time, result.err().unwrap_or(0));
+				match result {
+					Ok(Some(pid)) => children.push((pid, slot)),
+					_ => finished(running, slot),
+				}
+			});
+		}
+
+		reap_children(children, |slot| finished(running, slot));
+	}
+
+	// Hands the command to the helper or the executor, the loop never
+	// waits for it. Builtins are left to the backend.
+	pub fn run(&mut self, monitor: usize, edge: Edge) -> Result<(), &'static str>
+	{
+		let slot = self.slot(monitor, edge);
+		match self.get(slot) {
+			Some(Action::Builtin(_)) | None => return Ok(()),
+			Some(_) => {}
+		}
+
+		if let Some((_, request, _)) = self.helper {
+			if !write_slot(request, slot) {
+				return Err("helper failed");
+			}
+			self.running[slot] += 1;
+			return Ok(());
+		}
+
+		let display = &self.display;
+		let executor = self.executor.get_or_insert_with(|| Executor::new(display.clone()));
+		if executor.push(self.table.clone(), slot).is_err() {
+			return Err("executor busy");
+		}
+		self.running[slot] += 1;
+
+		return Ok(());
+	}
+}
+
+impl Drop for Launcher {
+	fn drop(&mut self)
+	{
+		self.stop_helper();
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn key_chords()
+	{
+		let key = |cmd: &str| match Action::parse(cmd) {
+			Ok(Some(Action::Builtin(Builtin::KEY(keys)))) => keys,
+			other => panic!("{:?}", other),
+		};
+
+		assert_eq!(key("@key super"), ["Super_L"]);
+		assert_eq!(key("@key ctrl+alt+t"), ["Control_L", "Alt_L", "t"]);
+		assert_eq!(key("@key Shift+F1"), ["Shift_L", "F1"]);
+		assert_eq!(key("@key Super_R"), ["Super_R"]);
+	}
+
+	#[test]
+	fn split_quotes()
+	{
+		assert_eq!(split("  a\tb  ").unwrap(), ["a", "b"]);
+		assert_eq!(split("echo 'a  b' \"c \\\" d\" e\\ f").unwrap(), ["echo", "a  b", "c \" d", "e f"]);
+		assert_eq!(split("'' \"\"").unwrap(), ["", ""]);
+		assert_eq!(split("\"a\\n\"").unwrap(), ["a\\n"]);
+		assert!(split("'open").is_err());
+		assert!(split("\"open").is_err());
+		assert!(split("").unwrap().is_empty());
+	}
+
+	#[test]
+	fn path_search_skips_bad_entries()
+	{
+		let paths = OsStr::from_bytes(b"/nonexistent/\xff:/nonexistent/a\0b:/bin:/usr/bin");
+
+		assert!(search("sh", paths).map_or(false, |path| path.ends_with("sh")));
+		assert_eq!(search("edges-none", paths), None);
+	}
+
+	#[test]
+	fn table_round_trip()
+	{
+		let mut row: [Option<Action>; 8] = Default::default();
+		row[0] = Action::parse("/bin/echo 'a b' c").unwrap();
+		row[5] = Action::parse("> /tmp/fifo hello").unwrap();
+		row[6] = Action::parse("@showdesktop").unwrap();
+		let table: Table = vec![row, Default::default()];
+
+		let buf = encode(&table);
+		assert_eq!(u32::from_ne_bytes(buf[..4].try_into().unwrap()) as usize, buf.len() - 4);
+
+		let decoded = decode(&buf[4..]).unwrap();
+		assert_eq!(decoded.len(), 2);
+		assert_eq!(format!("{:?}", decoded[0][0]), format!("{:?}", table[0][0]));
+		assert_eq!(format!("{:?}", decoded[0][5]), format!("{:?}", table[0][5]));
+		assert!(decoded[0][6].is_none());
+		assert!(decoded[1].iter().all(|a| a.is_none()));
+
+		match &decoded[0][0] {
+			Some(Action::Exec { args, argv, .. }) => {
+				assert_eq!(argv.len(), args.len() + 1);
+				assert_eq!(argv[1], args[1].as_ptr() as *mut libc::c_char);
+			}
+			_ => panic!("not an exec"),
+		}
+	}
+
+	fn wait(launcher: &mut Launcher, until: impl Fn(&Launcher) -> bool)
+	{
+		for _ in 0..200 {
+			launcher.reap(|_, _, errno| assert_eq!(errno, 0));
+			if until(launcher) {
+				return;
+			}
+			std::thread::sleep(std::time::Duration::from_millis(10));
+		}
+		panic!("timed out");
+	}
+
+	#[test]
+	fn children_survive_a_new_table_shape()
+	{
+		let row = |cmd: &str| {
+			let mut row: [Option<Action>; 8] = Default::default();
+			row[0] = Action::parse(cmd).unwrap();
+			row
+		};
+
+		let mut launcher = Launcher::new(vec![row("sleep 0.2")], true, None);
+		launcher.run(0, Edge::TOPLEFT).unwrap();
+		wait(&mut launcher, |l| l.children.len() == 1);
+
+		launcher.set_actions(vec![row("true"), row("true")], [false; 8]).unwrap();
+		assert!(launcher.running(0, Edge::TOPLEFT));
+
+		wait(&mut launcher, |l| l.children.is_empty());
+		assert!(!launcher.running(0, Edge::TOPLEFT));
+	}
+
+	#[test]
+	fn failed_launches_are_reported()
+	{
+		let mut row: [Option<Action>; 8] = Default::default();
+		row[4] = Action::parse("/nonexistent/edges-test").unwrap();
+
+		let mut launcher = Launcher::new(vec![row], false, None);
+		launcher.run(0, Edge::LEFT).unwrap();
+
+		let mut failed = Vec::new();
+		for _ in 0..200 {
+			launcher.reap(|slot, _, errno| if errno != 0 { failed.push((slot, errno)) });
+			if !launcher.running(0, Edge::LEFT) {
+				break;
+			}
+			std::thread::sleep(std::time::Duration::from_millis(10));
+		}
+		assert_eq!(failed, vec![(Edge::LEFT as usize, libc::ENOENT)]);
+	}
+	#[test]
+	fn warm_children_take_signals()
+	{
+		let path = std::env::temp_dir().join(format!("edges-{}-sigign", std::process::id()));
+		let mut row: [Option<Action>; 8] = Default::default();
+		row[0] = Action::parse(&format!("sh -c 'grep SigIgn /proc/self/status > {}'", path.display())).unwrap();
+
+		let mut launcher = Launcher::new(vec![row], false, None);
+		launcher.warm();
+		launcher.run(0, Edge::TOPLEFT).unwrap();
+
+		let mut ignored = None;
+		for _ in 0..200 {
+			launcher.reap(|_, _, _| {});
+			ignored = std::fs::read_to_string(&path).ok()
+				.and_then(|s| u64::from_str_radix(s.trim_start_matches("SigIgn:").trim(), 16).ok());
+			if ignored.is_some() {
+				break;
+			}
+			std::thread::sleep(std::time::Duration::from_millis(10));
+		}
+		let _ = std::fs::remove_file(&path);
+
+		let signals = [libc::SIGINT, libc::SIGTERM, libc::SIGHUP, libc::SIGUSR1, libc::SIGPIPE];
+		let mask = signals.iter().fold(0u64, |mask, &signal| mask | 1 << (signal - 1));
+		assert_eq!(ignored.map(|ignored| ignored & mask), Some(0));
+	}
+}
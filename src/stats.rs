@@ -0,0 +1,204 @@
+// Counters and latency histograms, dumped on SIGUSR1, and startup timing
+
+use std::fmt::Write;
+use std::time::Duration;
+use std::time::Instant;
+use crate::layout::EDGES;
+
+// Power of two buckets in microseconds, the last one takes the rest
+const BUCKETS: usize = 24;
+
+#[derive(Debug, Clone, Copy)]
+pub struct Histogram {
+	buckets: [u64; BUCKETS],
+	count: u64,
+	sum: u64,
+	max: u64,
+}
+
+impl Histogram {
+	pub fn new() -> Histogram
+	{
+		return Histogram { buckets: [0; BUCKETS], count: 0, sum: 0, max: 0 };
+	}
+
+	pub fn add(&mut self, d: Duration)
+	{
+		let us = d.as_micros() as u64;
+		let i = (64 - us.leading_zeros() as usize).min(BUCKETS - 1);
+
+		self.buckets[i] += 1;
+		self.count += 1;
+		self.sum += us;
+		self.max = self.max.max(us);
+	}
+
+	// Upper bound of the bucket holding the given fraction of samples
+	fn quantile(&self, q: f64) -> u64
+	{
+		let target = ((self.count as f64) * q).ceil().max(1.0) as u64;
+		let mut seen = 0;
+
+		for (i, n) in self.buckets.iter().enumerate() {
+			seen += n;
+			if seen >= target {
+				return if i == BUCKETS - 1 { self.max } else { (1u64 << i).min(self.max) };
+			}
+		}
+
+		return self.max;
+	}
+
+	fn format(&self, out: &mut String, name: &str)
+	{
+		if self.count == 0 {
+			return;
+		}
+
+		let _ = writeln!(out, "{:<20} n={} avg={}us p50<={}us p99<={}us max={}us",
+				 name, self.count, self.sum / self.count,
+				 self.quantile(0.5), self.quantile(0.99), self.max);
+	}
+}
+
+// Prints the time of each startup phase with --startup-timing
+#[derive(Debug)]
+pub struct Startup {
+	enabled: bool,
+	start: Instant,
+	last: Instant,
+}
+
+impl Startup {
+	pub fn new(enabled: bool, start: Instant) -> Startup
+	{
+		return Startup { enabled, start, last: start };
+	}
+
+	pub fn mark(&mut self, phase: &str)
+	{
+		if !self.enabled {
+			return;
+		}
+
+		let now = Instant::now();
+		eprintln!("startup {:9.3} ms {:+9.3} ms  {}", (now - self.start).as_secs_f64() * 1000.0,
+			  (now - self.last).as_secs_f64() * 1000.0, phase);
+		self.last = now;
+	}
+
+	// The last phase, later marks are ignored
+	pub fn finish(&mut self, phase: &str)
+	{
+		self.mark(phase);
+		self.enabled = false;
+	}
+}
+
+#[derive(Debug)]
+pub struct Stats {
+	started: Instant,
+
+	// Raw motion events received and those that got a position
+	pub events: u64,
+	pub processed: u64,
+	pub suppressed: u64,
+	pub coalesced: u64,
+
+	pub query: Histogram,
+	pub detect: Histogram,
+	pub spawn: [Histogram; 8],
+
+	pub startup: Startup,
+
+	// Rate since the previous dump
+	last: (Instant, u64),
+}
+
+impl Stats {
+	pub fn new() -> Stats
+	{
+		let now = Instant::now();
+
+		return Stats {
+			started: now,
+			events: 0,
+			processed: 0,
+			suppressed: 0,
+			coalesced: 0,
+			query: Histogram::new(),
+			detect: Histogram::new(),
+			spawn: [Histogram::new(); 8],
+			startup: Startup::new(false, now),
+			last: (now, 0),
+		};
+	}
+
+	pub fn dump(&mut self) -> String
+	{
+		let now = Instant::now();
+		let uptime = now.duration_since(self.started).as_secs_f64();
+		let since = now.duration_since(self.last.0).as_secs_f64();
+		let rate = if since > 0.0 { (self.processed - self.last.1) as f64 / since } else { 0.0 };
+		self.last = (now, self.processed);
+
+		let mut out = String::new();
+		let _ = writeln!(out, "uptime               {:.0}s", uptime);
+		let _ = writeln!(out, "events               {}", self.events);
+		let _ = writeln!(out, "processed            {} ({:.1}/s)", self.processed, rate);
+		let _ = writeln!(out, "suppressed           {}", self.suppressed);
+		let _ = writeln!(out, "coalesced            {}", self.coalesced);
+		self.query.format(&mut out, "query");
+		self.detect.format(&mut out, "detect");
+		for edge in EDGES {
+			self.spawn[edge as usize].format(&mut out, &format!("spawn {}", edge.name()));
+		}
+
+		return out;
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	fn us(us: u64) -> Duration
+	{
+		return Duration::from_micros(us);
+	}
+
+	#[test]
+	fn histogram_quantiles()
+	{
+		let mut h = Histogram::new();
+		for _ in 0..98 {
+			h.add(us(3));
+		}
+		h.add(us(100));
+		h.add(us(50_000));
+
+		assert_eq!((h.count, h.max), (100, 50_000));
+		assert_eq!(h.quantile(0.5), 4);
+		assert_eq!(h.quantile(0.99), 128);
+		assert_eq!(h.quantile(1.0), 50_000);
+
+		// Anything past the last bucket lands in it
+		let mut h = Histogram::new();
+		h.add(Duration::from_secs(3600));
+		assert_eq!(h.buckets[BUCKETS - 1], 1);
+		assert_eq!(h.quantile(0.5), 3_600_000_000);
+	}
+
+	#[test]
+	fn dump_skips_empty_histograms()
+	{
+		let mut stats = Stats::new();
+		stats.events = 3;
+		stats.spawn[EDGES[1] as usize].add(us(10));
+
+		let dump = stats.dump();
+		assert!(dump.contains("events               3\n"));
+		assert!(dump.contains("spawn topright       n=1 avg=10us p50<=10us p99<=10us max=10us\n"));
+		assert!(!dump.contains("query") && !dump.contains("spawn topleft"));
+	}
+}
@@ -0,0 +1,292 @@
+// Buffered trace output
+//
+// Records are formatted into a buffer that is handed to a writer thread
+// once per loop iteration, so tracing never blocks the main loop. If the
+// writer falls behind, records are dropped and counted instead. The thread
+// is only started once there is something to write.
+
+use std::io::Write;
+use std::str::FromStr;
+use std::sync::mpsc;
+use std::thread;
+use std::time::SystemTime;
+use std::time::UNIX_EPOCH;
+
+// Buffers queued for the writer thread before records get dropped
+const QUEUE_LEN: usize = 64;
+
+#[derive(Debug, Clone, Copy, PartialEq, PartialOrd)]
+pub enum Level {
+	OFF,
+	ERROR,
+	WARN,
+	INFO,
+	DEBUG,
+	TRACE,
+}
+
+impl Level {
+	fn name(&self) -> &'static str
+	{
+		return match self {
+			Level::OFF => "off",
+			Level::ERROR => "error",
+			Level::WARN => "warn",
+			Level::INFO => "info",
+			Level::DEBUG => "debug",
+			Level::TRACE => "trace",
+		};
+	}
+}
+
+impl FromStr for Level {
+	type Err = String;
+
+	fn from_str(s: &str) -> Result<Level, String>
+	{
+		return match s {
+			"off" => Ok(Level::OFF),
+			"error" => Ok(Level::ERROR),
+			"warn" => Ok(Level::WARN),
+			"info" => Ok(Level::INFO),
+			"debug" => Ok(Level::DEBUG),
+			"trace" => Ok(Level::TRACE),
+			_ => Err(format!("invalid log level: {}", s)),
+		};
+	}
+}
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum Format {
+	TEXT,
+	JSON,
+}
+
+impl FromStr for Format {
+	type Err = String;
+
+	fn from_str(s: &str) -> Result<Format, String>
+	{
+		return match s {
+			"text" => Ok(Format::TEXT),
+			"json" => Ok(Format::JSON),
+			_ => Err(format!("invalid log format: {}", s)),
+		};
+	}
+}
+
+#[derive(Debug, Clone, Copy)]
+pub enum Value<'a> {
+	Int(i64),
+	Str(&'a str),
+}
+
+impl<'a> From<i64> for Value<'a> {
+	fn from(v: i64) -> Value<'a>
+	{
+		return Value::Int(v);
+	}
+}
+
+impl<'a> From<i32> for Value<'a> {
+	fn from(v: i32) -> Value<'a>
+	{
+		return Value::Int(v as i64);
+	}
+}
+
+impl<'a> From<usize> for Value<'a> {
+	fn from(v: usize) -> Value<'a>
+	{
+		return Value::Int(v as i64);
+	}
+}
+
+impl<'a> From<&'a str> for Value<'a> {
+	fn from(v: &'a str) -> Value<'a>
+	{
+		return Value::Str(v);
+	}
+}
+
+pub struct Tracer {
+	level: Level,
+	format: Format,
+	buf: Vec<u8>,
+	tx: Option<mpsc::SyncSender<Vec<u8>>>,
+	writer: Option<thread::JoinHandle<()>>,
+	dropped: u64,
+}
+
+impl Tracer {
+	pub fn new(level: Level, format: Format) -> Tracer
+	{
+		return Tracer {
+			level,
+			format,
+			buf: Vec::new(),
+			tx: None,
+			writer: None,
+			dropped: 0,
+		};
+	}
+
+	fn start(&mut self)
+	{
+		let (tx, rx) = mpsc::sync_channel::<Vec<u8>>(QUEUE_LEN);
+		self.writer = Some(thread::spawn(move || {
+			let stdout = std::io::stdout();
+			for buf in rx {
+				let _ = stdout.lock().write_all(&buf);
+			}
+		}));
+
+		self.tx = Some(tx);
+	}
+
+	pub fn enabled(&self, level: Level) -> bool
+	{
+		return level <= self.level && level != Level::OFF;
+	}
+
+	pub fn record(&mut self, level: Level, event: &str, fields: &[(&str, Value)])
+	{
+		if !self.enabled(level) {
+			return;
+		}
+
+		let now = SystemTime::now().duration_since(UNIX_EPOCH).unwrap_or_default();
+		let (secs, micros) = (now.as_secs(), now.subsec_micros());
+		let buf = &mut self.buf;
+
+		match self.format {
+			Format::TEXT => {
+				let _ = write!(buf, "{}.{:06} {} {}", secs, micros, level.name(), event);
+				for (key, value) in fields {
+					let _ = match value {
+						Value::Int(v) => write!(buf, " {}={}", key, v),
+						Value::Str(v) => write!(buf, " {}={}", key, v),
+					};
+				}
+			}
+			Format::JSON => {
+				let _ = write!(buf, "{{\"ts\":{}.{:06},\"level\":\"{}\",\"event\":", secs, micros, level.name());
+				json_string(buf, event);
+				for (key, value) in fields {
+					buf.push(b',');
+					json_string(buf, key);
+					buf.push(b':');
+					match value {
+						Value::Int(v) => { let _ = write!(buf, "{}", v); }
+						Value::Str(v) => json_string(buf, v),
+					}
+				}
+				buf.push(b'}');
+			}
+		}
+		buf.push(b'\n');
+	}
+
+	// Hands the buffered records to the writer thread without blocking
+	pub fn flush(&mut self)
+	{
+		if self.buf.is_empty() {
+			return;
+		}
+
+		if self.tx.is_none() {
+			self.start();
+		}
+		let tx = self.tx.as_ref().unwrap();
+
+		let buf = std::mem::replace(&mut self.buf, Vec::with_capacity(4096));
+		let lines = buf.iter().filter(|&&b| b == b'\n').count() as u64;
+
+		if let Err(mpsc::TrySendError::Full(_)) = tx.try_send(buf) {
+			self.dropped += lines;
+		}
+	}
+}
+
+impl Drop for Tracer {
+	fn drop(&mut self)
+	{
+		if self.dropped > 0 {
+			let dropped = self.dropped as i64;
+			self.record(Level::WARN, "dropped", &[("records", dropped.into())]);
+		}
+		self.flush();
+
+		// Let the writer finish the queue
+		self.tx = None;
+		if let Some(writer) = self.writer.take() {
+			let _ = writer.join();
+		}
+	}
+}
+
+fn json_string(buf: &mut Vec<u8>, s: &str)
+{
+	buf.push(b'"');
+	for c in s.chars() {
+		match c {
+			'"' => buf.extend_from_slice(b"\\\""),
+			'\\' => buf.extend_from_slice(b"\\\\"),
+			'\n' => buf.extend_from_slice(b"\\n"),
+			c if (c as u32) < 0x20 => { let _ = write!(buf, "\\u{:04x}", c as u32); }
+			c => {
+				let mut tmp = [0u8; 4];
+				buf.extend_from_slice(c.encode_utf8(&mut tmp).as_bytes());
+			}
+		}
+	}
+	buf.push(b'"');
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	// Takes the buffered records without the timestamps
+	fn take(tracer: &mut Tracer) -> Vec<String>
+	{
+		let buf = String::from_utf8(std::mem::take(&mut tracer.buf)).unwrap();
+
+		return buf.lines().map(|line| match tracer.format {
+			Format::TEXT => line.split_once(' ').unwrap().1.to_string(),
+			Format::JSON => line.split_once(",\"level\"").map(|(_, rest)| format!("{{\"level\"{}", rest)).unwrap(),
+		}).collect();
+	}
+
+	#[test]
+	fn levels()
+	{
+		assert_eq!("debug".parse(), Ok(Level::DEBUG));
+		assert!("verbose".parse::<Level>().is_err());
+		assert_eq!("json".parse(), Ok(Format::JSON));
+
+		let tracer = Tracer::new(Level::INFO, Format::TEXT);
+		assert!(tracer.enabled(Level::ERROR) && tracer.enabled(Level::INFO));
+		assert!(!tracer.enabled(Level::DEBUG) && !tracer.enabled(Level::OFF));
+		assert!(!Tracer::new(Level::OFF, Format::TEXT).enabled(Level::ERROR));
+	}
+
+	#[test]
+	fn text_records()
+	{
+		let mut tracer = Tracer::new(Level::INFO, Format::TEXT);
+		tracer.record(Level::INFO, "hit", &[("edge", "top".into()), ("monitor", 1.into())]);
+		tracer.record(Level::DEBUG, "motion", &[]);
+
+		assert_eq!(take(&mut tracer), ["info hit edge=top monitor=1"]);
+	}
+
+	#[test]
+	fn json_records()
+	{
+		let mut tracer = Tracer::new(Level::TRACE, Format::JSON);
+		tracer.record(Level::WARN, "launch", &[("error", "a \"b\"\n\u{1}".into()), ("row", (-2i64).into())]);
+
+		assert_eq!(take(&mut tracer), [r#"{"level":"warn","event":"launch","error":"a \"b\"\n\u0001","row":-2}"#]);
+	}
+}
@@ -0,0 +1,426 @@
+// Per edge trigger state machine
+//
+// Besides the dwell time, a hit can require the pointer to push on past
+// the edge, raw motion keeps reporting deltas while the position is
+// clamped, and to arrive slower than a maximum velocity. The velocity is
+// measured over short windows of the motion stream.
+
+use std::time::Duration;
+use std::time::Instant;
+use crate::layout::Edge;
+use crate::layout::EDGES;
+use crate::layout::Layout;
+use crate::layout::Rect;
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum State {
+	// Waiting for the pointer to enter the zone
+	ARMED,
+	// In the zone, pushed the given distance past the edge so far
+	PUSHING(f64),
+	// In the zone since the given time, waiting for the dwell time
+	DWELLING(Instant),
+	// Fired, waiting for the pointer to leave by the rearm distance
+	TRIGGERED,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum Hit {
+	NONE,
+	// Run the command of the edge on the monitor
+	FIRE(usize, Edge),
+	// In a hot zone that must not fire, with the reason
+	SUPPRESSED(usize, Edge, &'static str),
+}
+
+#[derive(Debug, Clone, Copy)]
+struct Zone {
+	state: State,
+	monitor: usize,
+	rect: Rect,
+}
+
+// Velocity is measured over windows of at least this length
+const VELOCITY_WINDOW: Duration = Duration::from_millis(25);
+
+// Windows without motion for this long mean the pointer stopped
+const VELOCITY_IDLE: Duration = Duration::from_millis(100);
+
+#[derive(Debug)]
+pub struct Trigger {
+	dwell: Duration,
+	rearm: i32,
+	// Pixels to push past the edge, 0 for none
+	push: f64,
+	// Pixels per second, 0 for no limit
+	max_velocity: f64,
+	zones: [Zone; 8],
+	last: Option<(i32, i32)>,
+
+	// Start of the current velocity window and the last measured velocity
+	window: Option<(Instant, i32, i32)>,
+	velocity: f64,
+}
+
+impl Trigger {
+	pub fn new(dwell: Duration, rearm: i32, push: u32, max_velocity: u32) -> Trigger
+	{
+		let zone = Zone {
+			state: State::ARMED,
+			monitor: 0,
+			rect: Rect { x: 0, y: 0, w: 0, h: 0 },
+		};
+
+		return Trigger {
+			dwell,
+			rearm: rearm.max(1),
+			push: push as f64,
+			max_velocity: max_velocity as f64,
+			zones: [zone; 8],
+			last: None,
+			window: None,
+			velocity: 0.0,
+		};
+	}
+
+	// Forgets all state, e.g. after the monitor setup changed
+	pub fn reset(&mut self)
+	{
+		for zone in self.zones.iter_mut() {
+			zone.state = State::ARMED;
+		}
+		self.last = None;
+		self.window = None;
+		self.velocity = 0.0;
+	}
+
+	// Speed over the last full window, only needed with a maximum
+	fn measure(&mut self, x: i32, y: i32, now: Instant)
+	{
+		if self.max_velocity == 0.0 {
+			return;
+		}
+
+		let (since, wx, wy) = match self.window {
+			Some(window) => window,
+			None => {
+				self.window = Some((now, x, y));
+				return;
+			}
+		};
+
+		let elapsed = now.saturating_duration_since(since);
+		if elapsed >= VELOCITY_IDLE {
+			self.velocity = 0.0;
+			self.window = Some((now, x, y));
+		} else if elapsed >= VELOCITY_WINDOW {
+			let distance = (((x - wx) as f64).powi(2) + ((y - wy) as f64).powi(2)).sqrt();
+			self.velocity = distance / elapsed.as_secs_f64();
+			self.window = Some((now, x, y));
+		}
+	}
+
+	// Feeds a new pointer position with the raw motion that led to it,
+	// the delta is 0 where the backend has none
+	pub fn motion(&mut self, layout: &Layout, x: i32, y: i32, delta: (f64, f64), now: Instant) -> Hit
+	{
+		self.measure(x, y, now);
+
+		// Rearm edges the pointer left far enough
+		for zone in self.zones.iter_mut() {
+			if zone.state == State::TRIGGERED && zone.rect.distance(x, y) >= self.rearm {
+				zone.state = State::ARMED;
+			}
+		}
+
+		let last = self.last.replace((x, y));
+
+		let (monitor, edge) = match layout.locate(x, y) {
+			Some(hit) => hit,
+			None => return Hit::NONE,
+		};
+
+		// Leaving a zone before the dwell time is over cancels it
+		for (i, zone) in self.zones.iter_mut().enumerate() {
+			if let State::DWELLING(_) | State::PUSHING(_) = zone.state {
+				if EDGES[i] != edge || zone.monitor != monitor {
+					zone.state = State::ARMED;
+				}
+			}
+		}
+
+		if edge != Edge::NONE {
+			return self.enter(layout, monitor, edge, delta, now);
+		}
+
+		// The pointer may have skipped a zone between two samples,
+		// crossing it is neither pushing nor dwelling
+		if let Some((lx, ly)) = last {
+			if self.dwell.is_zero() && self.push == 0.0 {
+				return self.cross(layout, monitor, (lx, ly), (x, y), now);
+			}
+		}
+
+		return Hit::NONE;
+	}
+
+	// Returns when the next dwelling zone fires
+	pub fn deadline(&self) -> Option<Instant>
+	{
+		return self.zones.iter().filter_map(|zone| match zone.state {
+			State::DWELLING(since) => Some(since + self.dwell),
+			_ => None,
+		}).min();
+	}
+
+	// Fires a zone whose dwell time is over
+	pub fn expire(&mut self, now: Instant) -> Option<(usize, Edge)>
+	{
+		for (i, zone) in self.zones.iter_mut().enumerate() {
+			if let State::DWELLING(since) = zone.state {
+				if now >= since + self.dwell {
+					zone.state = State::TRIGGERED;
+					return Some((zone.monitor, EDGES[i]));
+				}
+			}
+		}
+
+		return None;
+	}
+
+	fn enter(&mut self, layout: &Layout, monitor: usize, edge: Edge, delta: (f64, f64), now: Instant) -> Hit
+	{
+		let zone = &mut self.zones[edge as usize];
+
+		match zone.state {
+			State::ARMED => {
+				// Skating through stays armed, the next motion in the zone
+				// is measured again
+				if self.max_velocity > 0.0 && self.velocity > self.max_velocity {
+					return Hit::SUPPRESSED(monitor, edge, "too fast");
+				}
+
+				zone.monitor = monitor;
+				zone.rect = layout.monitors[monitor].zone(edge);
+
+				if self.push > 0.0 {
+					zone.state = State::PUSHING(0.0);
+					return Hit::SUPPRESSED(monitor, edge, "pushing");
+				}
+			}
+			State::PUSHING(pushed) => {
+				let pushed = pushed + outward(edge, delta);
+				if pushed < self.push {
+					zone.state = State::PUSHING(pushed);
+					return Hit::SUPPRESSED(monitor, edge, "pushing");
+				}
+			}
+			State::DWELLING(_) => return Hit::SUPPRESSED(monitor, edge, "dwelling"),
+			State::TRIGGERED => return Hit::SUPPRESSED(monitor, edge, "not rearmed"),
+		}
+
+		if self.dwell.is_zero() {
+			zone.state = State::TRIGGERED;
+			return Hit::FIRE(monitor, edge);
+		}
+
+		zone.state = State::DWELLING(now);
+
+		return Hit::SUPPRESSED(monitor, edge, "dwelling");
+	}
+
+	fn cross(&mut self, layout: &Layout, monitor: usize, from: (i32, i32), to: (i32, i32), now: Instant) -> Hit
+	{
+		let m = &layout.monitors[monitor];
+
+		// Zones lie along the monitor bounds, most segments never get there
+		if from.0.min(to.0) > m.xmin + m.depth && from.0.max(to.0) < m.xmax - m.depth &&
+		   from.1.min(to.1) > m.ymin + m.depth && from.1.max(to.1) < m.ymax - m.depth {
+			return Hit::NONE;
+		}
+
+		for edge in EDGES {
+			if self.zones[edge as usize].state != State::ARMED {
+				continue;
+			}
+
+			// Leaving a zone is not crossing it
+			let rect = m.zone(edge);
+			if rect.contains(from.0, from.1) {
+				continue;
+			}
+
+			let (x, y) = match intersect(from, to, rect) {
+				Some(p) => p,
+				None => continue,
+			};
+
+			// Shared edges are not hot
+			if layout.locate(x, y) == Some((monitor, edge)) {
+				return self.enter(layout, monitor, edge, (0.0, 0.0), now);
+			}
+		}
+
+		return Hit::NONE;
+	}
+}
+
+// Part of a motion that points out of the screen past the edge
+fn outward(edge: Edge, delta: (f64, f64)) -> f64
+{
+	let (dx, dy) = delta;
+
+	return match edge {
+		Edge::TOPLEFT => (-dx).max(0.0) + (-dy).max(0.0),
+		Edge::TOPRIGHT => dx.max(0.0) + (-dy).max(0.0),
+		Edge::BOTTOMRIGHT => dx.max(0.0) + dy.max(0.0),
+		Edge::BOTTOMLEFT => (-dx).max(0.0) + dy.max(0.0),
+		Edge::LEFT => (-dx).max(0.0),
+		Edge::TOP => (-dy).max(0.0),
+		Edge::RIGHT => dx.max(0.0),
+		Edge::BOTTOM => dy.max(0.0),
+		Edge::NONE => 0.0,
+	};
+}
+
+// Returns the first pixel of the rectangle on the segment (Liang-Barsky)
+fn intersect(from: (i32, i32), to: (i32, i32), rect: Rect) -> Option<(i32, i32)>
+{
+	if rect.w <= 0 || rect.h <= 0 {
+		return None;
+	}
+
+	let (x0, y0) = (from.0 as f64, from.1 as f64);
+	let dx = (to.0 - from.0) as f64;
+	let dy = (to.1 - from.1) as f64;
+
+	// Pixels are covered up to half a pixel around their center
+	let xmin = rect.x as f64 - 0.5;
+	let xmax = (rect.x + rect.w) as f64 - 0.5;
+	let ymin = rect.y as f64 - 0.5;
+	let ymax = (rect.y + rect.h) as f64 - 0.5;
+
+	let mut t0: f64 = 0.0;
+	let mut t1: f64 = 1.0;
+
+	for (p, q) in [(-dx, x0 - xmin), (dx, xmax - x0), (-dy, y0 - ymin), (dy, ymax - y0)] {
+		if p == 0.0 {
+			if q < 0.0 {
+				return None;
+			}
+			continue;
+		}
+
+		let t = q / p;
+		if p < 0.0 {
+			t0 = t0.max(t);
+		} else {
+			t1 = t1.min(t);
+		}
+		if t0 > t1 {
+			return None;
+		}
+	}
+
+	let x = (x0 + t0 * dx).round() as i32;
+	let y = (y0 + t0 * dy).round() as i32;
+
+	return Some((x.clamp(rect.x, rect.x + rect.w - 1), y.clamp(rect.y, rect.y + rect.h - 1)));
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	fn layout() -> Layout
+	{
+		return Layout::new(1920, 1080, &[]);
+	}
+
+	fn ms(base: Instant, ms: u64) -> Instant
+	{
+		return base + Duration::from_millis(ms);
+	}
+
+	#[test]
+	fn fires_once_until_rearmed()
+	{
+		let (layout, t) = (layout(), Instant::now());
+		let mut trigger = Trigger::new(Duration::ZERO, 10, 0, 0);
+
+		assert_eq!(trigger.motion(&layout, 500, 500, (0.0, 0.0), t), Hit::NONE);
+		assert_eq!(trigger.motion(&layout, 0, 0, (0.0, 0.0), t), Hit::FIRE(0, Edge::TOPLEFT));
+		assert_eq!(trigger.motion(&layout, 0, 0, (0.0, 0.0), t), Hit::SUPPRESSED(0, Edge::TOPLEFT, "not rearmed"));
+
+		// Not far enough away yet
+		trigger.motion(&layout, 5, 5, (0.0, 0.0), t);
+		assert_eq!(trigger.motion(&layout, 0, 0, (0.0, 0.0), t), Hit::SUPPRESSED(0, Edge::TOPLEFT, "not rearmed"));
+
+		trigger.motion(&layout, 20, 20, (0.0, 0.0), t);
+		assert_eq!(trigger.motion(&layout, 0, 0, (0.0, 0.0), t), Hit::FIRE(0, Edge::TOPLEFT));
+	}
+
+	#[test]
+	fn dwell_fires_on_expiry()
+	{
+		let (layout, t) = (layout(), Instant::now());
+		let mut trigger = Trigger::new(Duration::from_millis(100), 1, 0, 0);
+
+		assert_eq!(trigger.motion(&layout, 1919, 0, (0.0, 0.0), t), Hit::SUPPRESSED(0, Edge::TOPRIGHT, "dwelling"));
+		assert_eq!(trigger.deadline(), Some(ms(t, 100)));
+		assert_eq!(trigger.expire(ms(t, 50)), None);
+		assert_eq!(trigger.expire(ms(t, 100)), Some((0, Edge::TOPRIGHT)));
+		assert_eq!(trigger.deadline(), None);
+
+		// Leaving early cancels
+		trigger.reset();
+		trigger.motion(&layout, 1919, 0, (0.0, 0.0), t);
+		trigger.motion(&layout, 900, 500, (0.0, 0.0), ms(t, 10));
+		assert_eq!(trigger.expire(ms(t, 200)), None);
+	}
+
+	#[test]
+	fn push_needs_outward_motion()
+	{
+		let (layout, t) = (layout(), Instant::now());
+		let mut trigger = Trigger::new(Duration::ZERO, 1, 20, 0);
+
+		assert_eq!(trigger.motion(&layout, 0, 540, (-5.0, 0.0), t), Hit::SUPPRESSED(0, Edge::LEFT, "pushing"));
+		assert_eq!(trigger.motion(&layout, 0, 540, (10.0, 0.0), t), Hit::SUPPRESSED(0, Edge::LEFT, "pushing"));
+		assert_eq!(trigger.motion(&layout, 0, 540, (-12.0, 3.0), t), Hit::SUPPRESSED(0, Edge::LEFT, "pushing"));
+		assert_eq!(trigger.motion(&layout, 0, 540, (-8.0, 0.0), t), Hit::FIRE(0, Edge::LEFT));
+	}
+
+	#[test]
+	fn skipped_zones_are_crossed()
+	{
+		let (layout, t) = (layout(), Instant::now());
+		let mut trigger = Trigger::new(Duration::ZERO, 1, 0, 0);
+
+		// Along the top past the hot middle between two samples
+		assert_eq!(trigger.motion(&layout, 400, 0, (0.0, 0.0), t), Hit::NONE);
+		assert_eq!(trigger.motion(&layout, 1500, 0, (0.0, 0.0), t), Hit::FIRE(0, Edge::TOP));
+
+		// Segments far from the bounds are skipped
+		trigger.reset();
+		trigger.motion(&layout, 400, 400, (0.0, 0.0), t);
+		assert_eq!(trigger.motion(&layout, 1500, 600, (0.0, 0.0), t), Hit::NONE);
+
+		assert_eq!(intersect((40, 40), (-2, -2), Rect { x: 0, y: 0, w: 1, h: 1 }), Some((0, 0)));
+		assert_eq!(intersect((40, 40), (30, 2), Rect { x: 0, y: 0, w: 1, h: 1 }), None);
+	}
+
+	#[test]
+	fn too_fast_is_suppressed()
+	{
+		let (layout, t) = (layout(), Instant::now());
+		let mut trigger = Trigger::new(Duration::ZERO, 1, 0, 1000);
+
+		trigger.motion(&layout, 900, 540, (0.0, 0.0), t);
+		trigger.motion(&layout, 100, 540, (0.0, 0.0), ms(t, 30));
+		assert_eq!(trigger.motion(&layout, 0, 540, (0.0, 0.0), ms(t, 31)), Hit::SUPPRESSED(0, Edge::LEFT, "too fast"));
+
+		// Slow again once it rested
+		assert_eq!(trigger.motion(&layout, 0, 540, (0.0, 0.0), ms(t, 200)), Hit::FIRE(0, Edge::LEFT));
+	}
+}
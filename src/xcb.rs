@@ -0,0 +1,569 @@
+// XCB backend, built with the xcb feature
+//
+// Requests are sent without waiting for their replies. The extension and
+// version queries, event selection and the first monitor query at startup
+// share one round trip, and the pointer queries of a batch of raw motion
+// events are all in flight before the first reply is read.
+
+#![allow(non_camel_case_types)]
+
+use std::collections::VecDeque;
+use std::ffi::CString;
+use std::os::raw::c_char;
+use std::os::raw::c_int;
+use std::os::raw::c_uint;
+use std::ptr;
+use std::time::Instant;
+use crate::backend::Backend;
+use crate::backend::Batch;
+use crate::backend::Sink;
+use crate::backend::Tracker;
+use crate::layout::Layout;
+use crate::layout::Rect;
+use crate::layout::Zones;
+use crate::stats::Startup;
+
+#[repr(C)]
+struct xcb_connection_t {
+	_private: [u8; 0],
+}
+
+#[repr(C)]
+struct xcb_extension_t {
+	name: *const c_char,
+	global_id: c_int,
+}
+
+#[derive(Clone, Copy)]
+#[repr(C)]
+struct xcb_cookie_t {
+	sequence: c_uint,
+}
+
+#[repr(C)]
+struct xcb_generic_event_t {
+	response_type: u8,
+	pad0: u8,
+	sequence: u16,
+	pad: [u32; 7],
+	full_sequence: u32,
+}
+
+#[repr(C)]
+struct xcb_ge_generic_event_t {
+	response_type: u8,
+	extension: u8,
+	sequence: u16,
+	length: u32,
+	event_type: u16,
+	pad0: [u8; 22],
+	full_sequence: u32,
+}
+
+// Followed by the valuator mask and the accelerated and raw values
+#[repr(C)]
+struct xcb_input_raw_motion_event_t {
+	response_type: u8,
+	extension: u8,
+	sequence: u16,
+	length: u32,
+	event_type: u16,
+	deviceid: u16,
+	time: u32,
+	detail: u32,
+	sourceid: u16,
+	valuators_len: u16,
+	flags: u32,
+	pad0: [u8; 4],
+	full_sequence: u32,
+}
+
+#[repr(C)]
+struct xcb_input_fp3232_t {
+	integral: i32,
+	frac: u32,
+}
+
+#[repr(C)]
+struct xcb_query_extension_reply_t {
+	response_type: u8,
+	pad0: u8,
+	sequence: u16,
+	length: u32,
+	present: u8,
+	major_opcode: u8,
+	first_event: u8,
+	first_error: u8,
+}
+
+// Only the leading fields are read
+#[repr(C)]
+struct xcb_screen_t {
+	root: u32,
+	default_colormap: u32,
+	white_pixel: u32,
+	black_pixel: u32,
+	current_input_masks: u32,
+	width_in_pixels: u16,
+	height_in_pixels: u16,
+}
+
+#[repr(C)]
+struct xcb_screen_iterator_t {
+	data: *mut xcb_screen_t,
+	rem: c_int,
+	index: c_int,
+}
+
+#[repr(C)]
+struct xcb_query_pointer_reply_t {
+	response_type: u8,
+	same_screen: u8,
+	sequence: u16,
+	length: u32,
+	root: u32,
+	child: u32,
+	root_x: i16,
+	root_y: i16,
+	win_x: i16,
+	win_y: i16,
+	mask: u16,
+	pad0: [u8; 2],
+}
+
+#[repr(C)]
+struct xcb_input_xi_query_version_reply_t {
+	response_type: u8,
+	pad0: u8,
+	sequence: u16,
+	length: u32,
+	major_version: u16,
+	minor_version: u16,
+	pad1: [u8; 20],
+}
+
+#[repr(C)]
+struct xcb_randr_query_version_reply_t {
+	response_type: u8,
+	pad0: u8,
+	sequence: u16,
+	length: u32,
+	major_version: u32,
+	minor_version: u32,
+	pad1: [u8; 16],
+}
+
+#[repr(C)]
+struct xcb_randr_get_monitors_reply_t {
+	response_type: u8,
+	pad0: u8,
+	sequence: u16,
+	length: u32,
+	timestamp: u32,
+	n_monitors: u32,
+	n_outputs: u32,
+	pad1: [u8; 12],
+}
+
+#[repr(C)]
+struct xcb_randr_monitor_info_t {
+	name: u32,
+	primary: u8,
+	automatic: u8,
+	n_output: u16,
+	x: i16,
+	y: i16,
+	width: u16,
+	height: u16,
+	width_in_millimeters: u32,
+	height_in_millimeters: u32,
+}
+
+#[repr(C)]
+struct xcb_get_atom_name_reply_t {
+	response_type: u8,
+	pad0: u8,
+	sequence: u16,
+	length: u32,
+	name_len: u16,
+	pad1: [u8; 22],
+}
+
+#[repr(C)]
+struct xcb_randr_monitor_info_iterator_t {
+	data: *mut xcb_randr_monitor_info_t,
+	rem: c_int,
+	index: c_int,
+}
+
+// One event mask for XISelectEvents
+#[repr(C)]
+struct xcb_input_event_mask_t {
+	deviceid: u16,
+	mask_len: u16,
+	mask: u32,
+}
+
+type xcb_setup_t = u8;
+type xcb_generic_error_t = u8;
+
+extern "C" {
+	static mut xcb_input_id: xcb_extension_t;
+	static mut xcb_randr_id: xcb_extension_t;
+
+	fn xcb_connect(display: *const c_char, screen: *mut c_int) -> *mut xcb_connection_t;
+	fn xcb_connection_has_error(c: *mut xcb_connection_t) -> c_int;
+	fn xcb_disconnect(c: *mut xcb_connection_t);
+	fn xcb_get_file_descriptor(c: *mut xcb_connection_t) -> c_int;
+	fn xcb_flush(c: *mut xcb_connection_t) -> c_int;
+	fn xcb_get_setup(c: *mut xcb_connection_t) -> *const xcb_setup_t;
+	fn xcb_setup_roots_iterator(setup: *const xcb_setup_t) -> xcb_screen_iterator_t;
+	fn xcb_screen_next(i: *mut xcb_screen_iterator_t);
+	fn xcb_prefetch_extension_data(c: *mut xcb_connection_t, ext: *mut xcb_extension_t);
+	fn xcb_get_extension_data(c: *mut xcb_connection_t, ext: *mut xcb_extension_t) -> *const xcb_query_extension_reply_t;
+	fn xcb_poll_for_event(c: *mut xcb_connection_t) -> *mut xcb_generic_event_t;
+
+	fn xcb_query_pointer(c: *mut xcb_connection_t, window: u32) -> xcb_cookie_t;
+	fn xcb_query_pointer_reply(c: *mut xcb_connection_t, cookie: xcb_cookie_t,
+				   e: *mut *mut xcb_generic_error_t) -> *mut xcb_query_pointer_reply_t;
+
+	fn xcb_get_atom_name(c: *mut xcb_connection_t, atom: u32) -> xcb_cookie_t;
+	fn xcb_get_atom_name_reply(c: *mut xcb_connection_t, cookie: xcb_cookie_t,
+				   e: *mut *mut xcb_generic_error_t) -> *mut xcb_get_atom_name_reply_t;
+	fn xcb_get_atom_name_name(r: *const xcb_get_atom_name_reply_t) -> *const c_char;
+	fn xcb_get_atom_name_name_length(r: *const xcb_get_atom_name_reply_t) -> c_int;
+
+	fn xcb_input_xi_query_version(c: *mut xcb_connection_t, major: u16, minor: u16) -> xcb_cookie_t;
+	fn xcb_input_xi_query_version_reply(c: *mut xcb_connection_t, cookie: xcb_cookie_t,
+					    e: *mut *mut xcb_generic_error_t) -> *mut xcb_input_xi_query_version_reply_t;
+	fn xcb_input_xi_select_events(c: *mut xcb_connection_t, window: u32, num_mask: u16,
+				      masks: *const xcb_input_event_mask_t) -> xcb_cookie_t;
+
+	fn xcb_randr_query_version(c: *mut xcb_connection_t, major: u32, minor: u32) -> xcb_cookie_t;
+	fn xcb_randr_query_version_reply(c: *mut xcb_connection_t, cookie: xcb_cookie_t,
+					 e: *mut *mut xcb_generic_error_t) -> *mut xcb_randr_query_version_reply_t;
+	fn xcb_randr_select_input(c: *mut xcb_connection_t, window: u32, enable: u16) -> xcb_cookie_t;
+	fn xcb_randr_get_monitors(c: *mut xcb_connection_t, window: u32, get_active: u8) -> xcb_cookie_t;
+	fn xcb_randr_get_monitors_reply(c: *mut xcb_connection_t, cookie: xcb_cookie_t,
+					e: *mut *mut xcb_generic_error_t) -> *mut xcb_randr_get_monitors_reply_t;
+	fn xcb_randr_get_monitors_monitors_iterator(r: *const xcb_randr_get_monitors_reply_t) -> xcb_randr_monitor_info_iterator_t;
+	fn xcb_randr_monitor_info_next(i: *mut xcb_randr_monitor_info_iterator_t);
+}
+
+const XCB_GE_GENERIC: u8 = 35;
+const XCB_INPUT_RAW_MOTION: u16 = 17;
+const XCB_INPUT_DEVICE_ALL_MASTER: u16 = 1;
+const XCB_RANDR_SCREEN_CHANGE_NOTIFY: u8 = 0;
+const XCB_RANDR_NOTIFY: u8 = 1;
+const XCB_RANDR_NOTIFY_MASK: u16 = 1 | 2 | 4;
+
+// Reply must be freed with libc::free, errors are returned as null
+unsafe fn free<T>(reply: *mut T)
+{
+	libc::free(reply as *mut libc::c_void);
+}
+
+// Returns the accelerated x and y deltas of a raw motion event
+unsafe fn raw_delta(event: *const xcb_input_raw_motion_event_t) -> (f64, f64)
+{
+	let mut delta = [0.0f64; 2];
+
+	let masks = (*event).valuators_len as usize;
+	let mask = event.add(1) as *const u32;
+	let mut value = mask.add(masks) as *const xcb_input_fp3232_t;
+
+	// Values are only present for valuators set in the mask
+	for i in 0..(masks * 32).min(2) {
+		if *mask.add(i / 32) & (1 << (i % 32)) == 0 {
+			continue;
+		}
+		delta[i] = (*value).integral as f64 + (*value).frac as f64 / 4294967296.0;
+		value = value.add(1);
+	}
+
+	return (delta[0], delta[1]);
+}
+
+unsafe fn layout_reply(c: *mut xcb_connection_t, cookie: xcb_cookie_t, width: i32, height: i32) -> Layout
+{
+	let reply = xcb_randr_get_monitors_reply(c, cookie, ptr::null_mut());
+	if reply.is_null() {
+		panic!("RRGetMonitors failed");
+	}
+
+	let mut rects = Vec::with_capacity((*reply).n_monitors as usize);
+	let mut names = Vec::with_capacity((*reply).n_monitors as usize);
+	let mut it = xcb_randr_get_monitors_monitors_iterator(reply);
+	while it.rem > 0 {
+		let m = &*it.data;
+		rects.push(Rect { x: m.x as i32, y: m.y as i32, w: m.width as i32, h: m.height as i32 });
+		names.push(xcb_get_atom_name(c, m.name));
+		xcb_randr_monitor_info_next(&mut it);
+	}
+	free(reply);
+
+	// The name requests went out together, one round trip for all
+	let mut layout = Layout::new(width, height, &rects);
+	layout.set_names(names.into_iter().map(|cookie| {
+		let reply = xcb_get_atom_name_reply(c, cookie, ptr::null_mut());
+		if reply.is_null() {
+			return String::new();
+		}
+		let name = std::slice::from_raw_parts(xcb_get_atom_name_name(reply) as *const u8,
+						      xcb_get_atom_name_name_length(reply) as usize);
+		let name = String::from_utf8_lossy(name).into_owned();
+		free(reply);
+		return name;
+	}).collect());
+
+	return layout;
+}
+
+// A motion waiting for its position
+enum Pending {
+	KNOWN(i32, i32, (f64, f64)),
+	QUERY(xcb_cookie_t, Instant, (f64, f64)),
+}
+
+pub struct Xcb {
+	c: *mut xcb_connection_t,
+	root: u32,
+	width: i32,
+	height: i32,
+	input_opcode: u8,
+	randr_event: u8,
+	track: bool,
+	tracker: Tracker,
+	batch: Batch,
+	layout: Layout,
+	zones: Zones,
+
+	// Monitor query in flight after a RandR notification
+	layout_cookie: Option<xcb_cookie_t>,
+	pending: VecDeque<Pending>,
+	announce: bool,
+}
+
+impl Xcb {
+	pub fn new(name: Option<&str>, track: bool, startup: &mut Startup) -> Xcb
+	{
+		unsafe {
+			// The given display or $DISPLAY
+			let c_name = name.map(|n| CString::new(n).unwrap());
+			let mut screen_num: c_int = 0;
+			let c = xcb_connect(c_name.as_ref().map_or(ptr::null(), |n| n.as_ptr()), &mut screen_num);
+			if xcb_connection_has_error(c) != 0 {
+				panic!("xcb_connect failed: {}", name.unwrap_or(""));
+			}
+			startup.mark("display");
+
+			let mut it = xcb_setup_roots_iterator(xcb_get_setup(c));
+			for _ in 0..screen_num {
+				xcb_screen_next(&mut it);
+			}
+			let screen = &*it.data;
+			let root = screen.root;
+
+			// Everything up to the first monitor query goes out at once
+			xcb_prefetch_extension_data(c, ptr::addr_of_mut!(xcb_input_id));
+			xcb_prefetch_extension_data(c, ptr::addr_of_mut!(xcb_randr_id));
+			let xi_version = xcb_input_xi_query_version(c, 2, 0);
+			let rr_version = xcb_randr_query_version(c, 1, 5);
+
+			let mask = xcb_input_event_mask_t {
+				deviceid: XCB_INPUT_DEVICE_ALL_MASTER,
+				mask_len: 1,
+				mask: 1 << XCB_INPUT_RAW_MOTION,
+			};
+			xcb_input_xi_select_events(c, root, 1, &mask);
+			xcb_randr_select_input(c, root, XCB_RANDR_NOTIFY_MASK);
+			let monitors = xcb_randr_get_monitors(c, root, 1);
+			xcb_flush(c);
+
+			let input = xcb_get_extension_data(c, ptr::addr_of_mut!(xcb_input_id));
+			if input.is_null() || (*input).present == 0 {
+				panic!("Failed to query XInputExtension");
+			}
+
+			let randr = xcb_get_extension_data(c, ptr::addr_of_mut!(xcb_randr_id));
+			if randr.is_null() || (*randr).present == 0 {
+				panic!("Xrandr >= 1.5 not available");
+			}
+
+			let reply = xcb_input_xi_query_version_reply(c, xi_version, ptr::null_mut());
+			if reply.is_null() || (*reply).major_version < 2 {
+				panic!("XInput >= 2.0 not available");
+			}
+			free(reply);
+
+			let reply = xcb_randr_query_version_reply(c, rr_version, ptr::null_mut());
+			if reply.is_null() || ((*reply).major_version == 1 && (*reply).minor_version < 5) {
+				panic!("Xrandr >= 1.5 not available");
+			}
+			free(reply);
+
+			let width = screen.width_in_pixels as i32;
+			let height = screen.height_in_pixels as i32;
+			let layout = layout_reply(c, monitors, width, height);
+			startup.mark("extensions and layout");
+
+			return Xcb {
+				c,
+				root,
+				width,
+				height,
+				input_opcode: (*input).major_opcode,
+				randr_event: (*randr).first_event,
+				track,
+				tracker: Tracker::new(),
+				batch: Batch::new(),
+				layout,
+				zones: Zones::new(),
+				layout_cookie: None,
+				pending: VecDeque::new(),
+				announce: true,
+			};
+		}
+	}
+
+	// Reads the replies of the queued motions in order
+	fn resolve(&mut self, sink: &mut dyn Sink)
+	{
+		while let Some(p) = self.pending.pop_front() {
+			let (x, y, delta) = match p {
+				Pending::KNOWN(x, y, delta) => (x, y, delta),
+				Pending::QUERY(cookie, sent, delta) => unsafe {
+					let reply = xcb_query_pointer_reply(self.c, cookie, ptr::null_mut());
+					if reply.is_null() {
+						continue;
+					}
+					let pos = ((*reply).root_x as i32, (*reply).root_y as i32);
+					free(reply);
+
+					sink.stats().query.add(sent.elapsed());
+					self.tracker.sync(pos.0, pos.1);
+					(pos.0, pos.1, delta)
+				},
+			};
+
+			sink.motion(&self.layout, x, y, delta);
+		}
+	}
+
+	fn update_layout(&mut self, sink: &mut dyn Sink)
+	{
+		if let Some(cookie) = self.layout_cookie.take() {
+			self.layout = unsafe { layout_reply(self.c, cookie, self.width, self.height) };
+			self.layout.set_zones(&self.zones);
+			self.tracker.synced = false;
+			sink.layout(&self.layout);
+		}
+	}
+}
+
+impl Backend for Xcb {
+	fn fd(&self) -> i32
+	{
+		return unsafe { xcb_get_file_descriptor(self.c) };
+	}
+
+	fn set_zones(&mut self, zones: &Zones)
+	{
+		self.zones = *zones;
+		self.layout.set_zones(zones);
+	}
+
+	fn dispatch(&mut self, sink: &mut dyn Sink)
+	{
+		if self.announce {
+			sink.layout(&self.layout);
+			self.announce = false;
+		}
+
+		// Replies may bring in events that the fd won't report again
+		loop {
+			unsafe {
+				self.drain(sink);
+			}
+			if self.pending.is_empty() {
+				break;
+			}
+			self.resolve(sink);
+		}
+	}
+}
+
+impl Xcb {
+	unsafe fn drain(&mut self, sink: &mut dyn Sink)
+	{
+		loop {
+			let event = xcb_poll_for_event(self.c);
+			if event.is_null() {
+				break;
+			}
+
+			let kind = (*event).response_type & 0x7f;
+
+			// Monitor setup changed? Earlier motions still use the old one
+			if kind == self.randr_event + XCB_RANDR_SCREEN_CHANGE_NOTIFY ||
+			   kind == self.randr_event + XCB_RANDR_NOTIFY {
+				if self.layout_cookie.is_none() {
+					self.flush_motion();
+					self.resolve(sink);
+					self.layout_cookie = Some(xcb_randr_get_monitors(self.c, self.root, 1));
+					xcb_flush(self.c);
+				}
+				free(event);
+				continue;
+			}
+
+			let ge = event as *const xcb_ge_generic_event_t;
+			if kind == XCB_GE_GENERIC && (*ge).extension == self.input_opcode &&
+			   (*ge).event_type == XCB_INPUT_RAW_MOTION {
+				sink.stats().events += 1;
+
+				// Rebuild the cache once per burst of notifications
+				if self.layout_cookie.is_some() {
+					self.update_layout(sink);
+				}
+
+				// Handled once the queue is drained, estimates are only
+				// good while no query is needed
+				let (dx, dy) = raw_delta(event as *const xcb_input_raw_motion_event_t);
+				let tracked = self.track && self.tracker.motion(dx, dy, &self.layout);
+				if !tracked {
+					self.tracker.synced = false;
+				}
+				self.batch.add(dx, dy, tracked);
+			}
+
+			free(event);
+		}
+
+		self.flush_motion();
+	}
+
+	// Queues the motions of the batch at the newest position
+	unsafe fn flush_motion(&mut self)
+	{
+		match self.batch.take() {
+			Some((delta, false)) => {
+				self.pending.push_back(Pending::KNOWN(self.tracker.x as i32, self.tracker.y as i32, delta));
+			}
+			Some((delta, true)) => {
+				let cookie = xcb_query_pointer(self.c, self.root);
+				self.pending.push_back(Pending::QUERY(cookie, Instant::now(), delta));
+			}
+			None => {}
+		}
+	}
+}
+
+impl Drop for Xcb {
+	fn drop(&mut self)
+	{
+		unsafe {
+			xcb_disconnect(self.c);
+		}
+	}
+}
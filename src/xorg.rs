@@ -0,0 +1,864 @@
+// X11 backend, raw motion events from XInput2 and monitors from RandR.
+// With barriers, XFixes pointer barriers along the outer monitor sides
+// report only pushes against them, so pointer motion elsewhere does not
+// wake us up at all.
+//
+// Optionally the active window is watched, while it is fullscreen on the
+// monitor of the pointer no pointer events are selected at all. With
+// other monitors around, the pointer is checked now and then meanwhile, so
+// their edges come back once it leaves the fullscreen monitor.
+//
+// In sparse mode raw motion is deselected while the pointer moves far
+// from the monitor bounds, and the pointer is sampled by a timer instead.
+// Once it stops or comes near the bounds raw motion is selected again, so
+// an idle pointer costs nothing either.
+
+use x11::dpms;
+use x11::xfixes;
+use x11::xlib;
+use x11::xrandr;
+use x11::xinput2;
+use x11::xtest;
+use std::ptr;
+use std::ffi::CStr;
+use std::ffi::CString;
+use std::os::raw::c_char;
+use std::os::raw::c_long;
+use std::os::raw::c_uchar;
+use std::os::raw::c_ulong;
+use std::os::raw::c_void;
+use std::mem::MaybeUninit;
+use std::sync::OnceLock;
+use std::time::Duration;
+use std::time::Instant;
+use crate::backend::Backend;
+use crate::backend::Batch;
+use crate::backend::Sink;
+use crate::backend::Tracker;
+use crate::layout::Edge;
+use crate::layout::Layout;
+use crate::layout::Rect;
+use crate::layout::Zones;
+use crate::spawn::Builtin;
+use crate::stats::Startup;
+
+// Returns the accelerated x and y deltas of a raw motion event
+fn raw_delta(event: *const xinput2::XIRawEvent) -> (f64, f64)
+{
+	let mut dx: f64 = 0.0;
+	let mut dy: f64 = 0.0;
+
+	unsafe {
+		let valuators = &(*event).valuators;
+		let mut value = valuators.values;
+
+		// Values are only present for valuators set in the mask
+		for i in 0..(valuators.mask_len * 8).min(2) {
+			if *valuators.mask.offset((i / 8) as isize) & (1 << (i % 8)) == 0 {
+				continue;
+			}
+			if i == 0 {
+				dx = *value;
+			} else {
+				dy = *value;
+			}
+			value = value.offset(1);
+		}
+	}
+
+	return (dx, dy);
+}
+
+// Pointer samples per second in sparse mode, fast enough that the
+// pointer can't reach the bounds from afar unnoticed at usual speeds,
+// and skipped zones are found on the segment between two samples
+const SAMPLE_INTERVAL: Duration = Duration::from_millis(20);
+
+// Checks per second while suspended whether the pointer left the monitor
+// of the fullscreen window
+const SUSPEND_INTERVAL: Duration = Duration::from_millis(250);
+
+// Selects raw motion or barrier events, or nothing
+fn select_events(display: *mut xlib::Display, window: xlib::Window, barriers: bool, enabled: bool)
+{
+	let mut mask = [0u8; (xinput2::XI_LASTEVENT as usize + 7) / 8]; // wtf?
+	if enabled && barriers {
+		xinput2::XISetMask(&mut mask, xinput2::XI_BarrierHit);
+		xinput2::XISetMask(&mut mask, xinput2::XI_BarrierLeave);
+	} else if enabled {
+		xinput2::XISetMask(&mut mask, xinput2::XI_RawMotion);
+	}
+
+	let mut event_mask = xinput2::XIEventMask {
+		deviceid: xinput2::XIAllMasterDevices,
+		mask_len: mask.len() as i32,
+		mask: &mut mask[0] as *mut u8,
+	};
+
+	unsafe {
+		xinput2::XISelectEvents(display, window, &mut event_mask, 1);
+		xlib::XFlush(display);
+	}
+}
+
+// Returns the items of a 32 bit window property
+fn get_property(display: *mut xlib::Display, window: xlib::Window, property: xlib::Atom, kind: xlib::Atom) -> Vec<u64>
+{
+	let mut actual: xlib::Atom = 0;
+	let mut format: i32 = 0;
+	let mut n: c_ulong = 0;
+	let mut after: c_ulong = 0;
+	let mut data: *mut c_uchar = ptr::null_mut();
+
+	unsafe {
+		if xlib::XGetWindowProperty(display, window, property, 0, 1024, xlib::False, kind,
+					    &mut actual, &mut format, &mut n, &mut after, &mut data) != xlib::Success as i32 ||
+		   data.is_null() {
+			return Vec::new();
+		}
+
+		// Format 32 items are longs on the client side
+		let items = if format == 32 {
+			std::slice::from_raw_parts(data as *const c_ulong, n as usize).iter().map(|&v| v as u64).collect()
+		} else {
+			Vec::new()
+		};
+		xlib::XFree(data as *mut c_void);
+
+		return items;
+	}
+}
+
+type ErrorHandler = unsafe extern "C" fn(*mut xlib::Display, *mut xlib::XErrorEvent) -> i32;
+
+// Handler of Xlib before ours, shared by all displays
+static PREVIOUS_HANDLER: OnceLock<Option<ErrorHandler>> = OnceLock::new();
+
+// X_ChangeWindowAttributes, X_GetWindowAttributes, X_GetGeometry,
+// X_GetProperty and X_TranslateCoords, the requests on the active window
+const WINDOW_REQUESTS: [u8; 5] = [2, 3, 14, 20, 40];
+
+const BAD_WINDOW: u8 = 3;
+
+// The active window may be gone by the time it is queried, other errors
+// go to the handler of Xlib as without --suspend-fullscreen
+unsafe extern "C" fn ignore_gone_windows(display: *mut xlib::Display, error: *mut xlib::XErrorEvent) -> i32
+{
+	if (*error).error_code == BAD_WINDOW && WINDOW_REQUESTS.contains(&(*error).request_code) {
+		return 0;
+	}
+
+	return match PREVIOUS_HANDLER.get().copied().flatten() {
+		Some(handler) => handler(display, error),
+		None => 0,
+	};
+}
+
+fn intern(display: *mut xlib::Display, name: &str) -> xlib::Atom
+{
+	let c_str = CString::new(name).unwrap();
+
+	return unsafe { xlib::XInternAtom(display, c_str.as_ptr(), xlib::False) };
+}
+
+// Sends an EWMH request to the window manager
+fn client_message(display: *mut xlib::Display, root: xlib::Window, message_type: xlib::Atom, value: c_long)
+{
+	let mut data = xlib::ClientMessageData::new();
+	data.set_long(0, value);
+
+	let message = xlib::XClientMessageEvent {
+		type_: xlib::ClientMessage,
+		serial: 0,
+		send_event: xlib::True,
+		display,
+		window: root,
+		message_type,
+		format: 32,
+		data,
+	};
+
+	unsafe {
+		xlib::XSendEvent(display, root, xlib::False,
+				 xlib::SubstructureRedirectMask | xlib::SubstructureNotifyMask,
+				 &mut xlib::XEvent::from(message));
+	}
+}
+
+// Atoms of the EWMH properties watched for fullscreen windows
+struct Ewmh {
+	active_window: xlib::Atom,
+	wm_state: xlib::Atom,
+	fullscreen: xlib::Atom,
+	// The watched active window, 0 if none
+	active: xlib::Window,
+}
+
+// Queries the monitor geometry from the X server
+fn get_layout(display: *mut xlib::Display, window: xlib::Window) -> Layout
+{
+	unsafe {
+		let mut nmonitors: i32 = 0;
+		let monitorinfo = xrandr::XRRGetMonitors(display, window, xlib::True, &mut nmonitors);
+		if monitorinfo.is_null() {
+			panic!("XRRGetMonitors failed");
+		}
+
+		let mut rects = Vec::with_capacity(nmonitors as usize);
+		let mut atoms = Vec::with_capacity(nmonitors as usize);
+		for i in 0..nmonitors {
+			let m = &*monitorinfo.offset(i as isize);
+			rects.push(Rect { x: m.x, y: m.y, w: m.width, h: m.height });
+			atoms.push(m.name);
+		}
+		xrandr::XRRFreeMonitors(monitorinfo);
+
+		let screen = xlib::XDefaultScreen(display);
+		let mut layout = Layout::new(xlib::XDisplayWidth(display, screen),
+					     xlib::XDisplayHeight(display, screen),
+					     &rects);
+
+		// Monitor names for [monitor:NAME], all in one round trip
+		let mut names: Vec<*mut c_char> = vec![ptr::null_mut(); atoms.len()];
+		if !atoms.is_empty() &&
+		   xlib::XGetAtomNames(display, atoms.as_mut_ptr(), atoms.len() as i32, names.as_mut_ptr()) != 0 {
+			layout.set_names(names.iter().map(|&name| {
+				let s = CStr::from_ptr(name).to_string_lossy().into_owned();
+				xlib::XFree(name as *mut c_void);
+				return s;
+			}).collect());
+		}
+
+		return layout;
+	}
+}
+
+// Creates barriers on all sides of the layout that border no monitor,
+// the pointer can pass them inwards
+fn create_barriers(display: *mut xlib::Display, window: xlib::Window, layout: &Layout) -> Vec<xfixes::PointerBarrier>
+{
+	let mut barriers = Vec::new();
+
+	for (side, r) in layout.outline() {
+		let (x1, y1, x2, y2, directions) = match side {
+			Edge::LEFT => (r.x, r.y, r.x, r.y + r.h, xfixes::BarrierPositiveX),
+			Edge::TOP => (r.x, r.y, r.x + r.w, r.y, xfixes::BarrierPositiveY),
+			Edge::RIGHT => (r.x + 1, r.y, r.x + 1, r.y + r.h, xfixes::BarrierNegativeX),
+			_ => (r.x, r.y + 1, r.x + r.w, r.y + 1, xfixes::BarrierNegativeY),
+		};
+
+		unsafe {
+			barriers.push(xfixes::XFixesCreatePointerBarrier(display, window, x1, y1, x2, y2,
+									 directions, 0, ptr::null_mut()));
+		}
+	}
+
+	return barriers;
+}
+
+pub struct Xorg {
+	display: *mut xlib::Display,
+	window: xlib::Window,
+	major_opcode: i32,
+	// RandR is set up with the first layout, 0 before
+	event_base: i32,
+	track: bool,
+	tracker: Tracker,
+	batch: Batch,
+	layout: Layout,
+	zones: Zones,
+
+	// Pointer barriers instead of raw motion
+	barriers: Option<Vec<xfixes::PointerBarrier>>,
+
+	// Rebuild the layout before the next motion
+	layout_changed: bool,
+
+	// Watch for fullscreen windows, suspended while one covers the monitor
+	// of the pointer
+	ewmh: Option<Ewmh>,
+	covered: Option<Rect>,
+	suspended: bool,
+	fullscreen_changed: bool,
+	// Time of the next check whether the pointer left the covered monitor
+	leave_check: Option<Instant>,
+
+	// Distance to the monitor bounds beyond which the pointer is sampled,
+	// 0 to always use raw motion
+	sparse: i32,
+	// Time of the next sample and the last sampled position
+	sampling: Option<(Instant, i32, i32)>,
+}
+
+impl Xorg {
+	// Only XInput is set up here, RandR and the monitors wait for the
+	// first motion, every query is a round trip on remote displays
+	pub fn new(name: Option<&str>, track: bool, barriers: bool, suspend: bool, sparse: i32, startup: &mut Startup) -> Xorg
+	{
+		unsafe {
+			// Open the given display or $DISPLAY
+			let c_name = name.map(|n| CString::new(n).unwrap());
+			let display = xlib::XOpenDisplay(c_name.as_ref().map_or(ptr::null(), |n| n.as_ptr()));
+			if display.is_null() {
+				panic!("XOpenDisplay failed: {}", name.unwrap_or(""));
+			}
+			startup.mark("display");
+
+			let window = xlib::XDefaultRootWindow(display);
+
+			// Query XInput2
+			let mut major_opcode: i32 = 0;
+			let mut first_event: i32 = 0;
+			let mut first_error: i32 = 0;
+			let c_str = CString::new("XInputExtension").unwrap();
+
+			if xlib::XQueryExtension(display,
+						 c_str.as_ptr(),
+						 &mut major_opcode,
+						 &mut first_event,
+						 &mut first_error) == xlib::False {
+				panic!("Failed to query XInputExtension");
+			}
+
+			// Barrier events need XInput 2.3 and XFixes 5
+			if barriers {
+				let mut major: i32 = 2;
+				let mut minor: i32 = 3;
+				let mut event: i32 = 0;
+				let mut error: i32 = 0;
+
+				if xinput2::XIQueryVersion(display, &mut major, &mut minor) != xlib::Success as i32 ||
+				   (major == 2 && minor < 3) {
+					panic!("XInput >= 2.3 needed for barriers");
+				}
+
+				major = 5;
+				minor = 0;
+				if xfixes::XFixesQueryExtension(display, &mut event, &mut error) == xlib::False ||
+				   xfixes::XFixesQueryVersion(display, &mut major, &mut minor) == 0 || major < 5 {
+					panic!("XFixes >= 5 needed for barriers");
+				}
+			}
+
+			select_events(display, window, barriers, true);
+			startup.mark("xinput");
+
+			// The window manager announces the active window on the root
+			let ewmh = if suspend {
+				let previous = xlib::XSetErrorHandler(Some(ignore_gone_windows));
+				PREVIOUS_HANDLER.get_or_init(|| previous);
+				xlib::XSelectInput(display, window, xlib::PropertyChangeMask);
+				Some(Ewmh {
+					active_window: intern(display, "_NET_ACTIVE_WINDOW"),
+					wm_state: intern(display, "_NET_WM_STATE"),
+					fullscreen: intern(display, "_NET_WM_STATE_FULLSCREEN"),
+					active: 0,
+				})
+			} else {
+				None
+			};
+
+			// Stand-in until the first motion
+			let screen = xlib::XDefaultScreen(display);
+			let layout = Layout::new(xlib::XDisplayWidth(display, screen),
+						 xlib::XDisplayHeight(display, screen),
+						 &[]);
+
+			return Xorg {
+				display,
+				window,
+				major_opcode,
+				event_base: 0,
+				track,
+				tracker: Tracker::new(),
+				batch: Batch::new(),
+				layout,
+				zones: Zones::new(),
+				barriers: if barriers { Some(Vec::new()) } else { None },
+				layout_changed: true,
+				fullscreen_changed: ewmh.is_some(),
+				ewmh,
+				covered: None,
+				suspended: false,
+				leave_check: None,
+				sparse: if barriers { 0 } else { sparse },
+				sampling: None,
+			};
+		}
+	}
+
+	// Returns the monitor covered by the active window if it is fullscreen
+	fn fullscreen(&mut self, sink: &mut dyn Sink) -> Option<Rect>
+	{
+		let display = self.display;
+		let ewmh = self.ewmh.as_mut()?;
+
+		// Follow the state changes of the active window only
+		let active = get_property(display, self.window, ewmh.active_window, xlib::XA_WINDOW)
+			.first().copied().unwrap_or(0) as xlib::Window;
+		if active != ewmh.active {
+			unsafe {
+				if ewmh.active != 0 {
+					xlib::XSelectInput(display, ewmh.active, 0);
+				}
+				if active != 0 {
+					xlib::XSelectInput(display, active, xlib::PropertyChangeMask);
+				}
+			}
+			ewmh.active = active;
+		}
+
+		if active == 0 || !get_property(display, active, ewmh.wm_state, xlib::XA_ATOM).contains(&(ewmh.fullscreen as u64)) {
+			return None;
+		}
+
+		let mut attrs = MaybeUninit::<xlib::XWindowAttributes>::uninit();
+		let mut x: i32 = 0;
+		let mut y: i32 = 0;
+		let mut child: xlib::Window = 0;
+		unsafe {
+			if xlib::XGetWindowAttributes(display, active, attrs.as_mut_ptr()) == 0 ||
+			   xlib::XTranslateCoordinates(display, active, self.window, 0, 0, &mut x, &mut y, &mut child) == xlib::False {
+				return None;
+			}
+		}
+		let attrs = unsafe { attrs.assume_init() };
+		let window = Rect { x, y, w: attrs.width, h: attrs.height };
+
+		if self.layout_changed {
+			self.update_layout(sink);
+		}
+		let i = self.layout.find(x + attrs.width / 2, y + attrs.height / 2)?;
+		let monitor = self.layout.monitors[i].rect;
+
+		if window.x <= monitor.x && window.y <= monitor.y &&
+		   window.x + window.w >= monitor.x + monitor.w &&
+		   window.y + window.h >= monitor.y + monitor.h {
+			return Some(monitor);
+		}
+		return None;
+	}
+
+	// Is the position far enough from the bounds of its monitor to sample?
+	fn far(&self, x: i32, y: i32) -> bool
+	{
+		let m = match self.layout.find(x, y) {
+			Some(i) => &self.layout.monitors[i],
+			None => return false,
+		};
+
+		return (x - m.xmin).min(m.xmax - x).min(y - m.ymin).min(m.ymax - y) > self.sparse + m.depth;
+	}
+
+	// Takes a pointer sample, raw motion takes over again once the
+	// pointer stopped or came near the bounds
+	fn sample(&mut self, sink: &mut dyn Sink)
+	{
+		let (_, lx, ly) = match self.sampling {
+			Some(sampling) if Instant::now() >= sampling.0 => sampling,
+			_ => return,
+		};
+
+		if self.layout_changed {
+			self.update_layout(sink);
+		}
+
+		let (x, y) = self.query_pointer(sink);
+		sink.stats().events += 1;
+
+		if self.covered.map_or(false, |r| r.contains(x, y)) {
+			self.suspend(sink, true);
+			return;
+		}
+		sink.motion(&self.layout, x, y, (0.0, 0.0));
+
+		if (x, y) == (lx, ly) || !self.far(x, y) {
+			self.sampling = None;
+			select_events(self.display, self.window, false, true);
+		} else {
+			self.sampling = Some((Instant::now() + SAMPLE_INTERVAL, x, y));
+		}
+	}
+
+	// Handles the motions of the batch at the newest position
+	fn flush_motion(&mut self, sink: &mut dyn Sink)
+	{
+		let (delta, query) = match self.batch.take() {
+			Some(batch) => batch,
+			None => return,
+		};
+
+		let (x, y) = if query {
+			self.query_pointer(sink)
+		} else {
+			(self.tracker.x as i32, self.tracker.y as i32)
+		};
+
+		// Moved onto the monitor of a fullscreen window
+		if self.covered.map_or(false, |r| r.contains(x, y)) {
+			self.suspend(sink, true);
+		} else {
+			sink.motion(&self.layout, x, y, delta);
+		}
+
+		// Far from the bounds, sample instead of every motion
+		if self.sparse > 0 && self.sampling.is_none() && !self.suspended && self.far(x, y) {
+			select_events(self.display, self.window, false, false);
+			self.sampling = Some((Instant::now() + SAMPLE_INTERVAL, x, y));
+		}
+	}
+
+	// Deselects pointer events while a fullscreen window covers the
+	// monitor of the pointer
+	fn update_suspended(&mut self, sink: &mut dyn Sink)
+	{
+		self.fullscreen_changed = false;
+		self.covered = self.fullscreen(sink);
+
+		let suspended = match self.covered {
+			Some(r) => {
+				let (x, y) = self.query_pointer(sink);
+				r.contains(x, y)
+			}
+			None => false,
+		};
+		self.suspend(sink, suspended);
+	}
+
+	fn suspend(&mut self, sink: &mut dyn Sink, suspended: bool)
+	{
+		// Nothing reports the pointer leaving, unless there is nowhere to go
+		self.leave_check = match self.covered {
+			Some(r) if suspended && self.layout.monitors.iter().any(|m| m.rect != r) => Some(Instant::now() + SUSPEND_INTERVAL),
+			_ => None,
+		};
+
+		if suspended == self.suspended {
+			return;
+		}
+
+		select_events(self.display, self.window, self.barriers.is_some(), !suspended);
+		self.suspended = suspended;
+		self.sampling = None;
+		self.tracker.synced = false;
+		sink.suspended(suspended);
+	}
+
+	// Resumes once the pointer left the monitor of the fullscreen window
+	fn check_leave(&mut self, sink: &mut dyn Sink)
+	{
+		match self.leave_check {
+			Some(next) if Instant::now() >= next => {}
+			_ => return,
+		}
+
+		if self.layout_changed {
+			self.update_layout(sink);
+		}
+
+		let (x, y) = self.query_pointer(sink);
+		if self.covered.map_or(false, |r| r.contains(x, y)) {
+			self.leave_check = Some(Instant::now() + SUSPEND_INTERVAL);
+			return;
+		}
+
+		self.suspend(sink, false);
+		sink.stats().events += 1;
+		sink.motion(&self.layout, x, y, (0.0, 0.0));
+	}
+
+	fn query_pointer(&mut self, sink: &mut dyn Sink) -> (i32, i32)
+	{
+		let mut root_ret: u64 = 0;
+		let mut child_ret: u64 = 0;
+		let mut winx_ret: i32 = 0;
+		let mut winy_ret: i32 = 0;
+		let mut mask_ret: u32 = 0;
+		let mut x: i32 = 0;
+		let mut y: i32 = 0;
+
+		let start = Instant::now();
+		unsafe {
+			xlib::XQueryPointer(self.display,
+					    self.window,
+					    &mut root_ret,
+					    &mut child_ret,
+					    &mut x,
+					    &mut y,
+					    &mut winx_ret,
+					    &mut winy_ret,
+					    &mut mask_ret);
+		}
+		sink.stats().query.add(start.elapsed());
+
+		self.tracker.sync(x, y);
+
+		return (x, y);
+	}
+
+	// Queries RandR and starts listening for monitor changes
+	fn init_randr(&mut self)
+	{
+		let mut have_randr_1_5: bool = false;
+		let mut event_base: i32 = 0;
+		let mut error_base: i32 = 0;
+
+		unsafe {
+			if xrandr::XRRQueryExtension(self.display, &mut event_base, &mut error_base) == xlib::True {
+				let mut major: i32 = 0;
+				let mut minor: i32 = 0;
+
+				xrandr::XRRQueryVersion(self.display, &mut major, &mut minor);
+
+				if (major == 1 && minor >= 5) || major > 1 {
+					have_randr_1_5 = true;
+				}
+			}
+
+			if !have_randr_1_5 {
+				panic!("Xrandr >= 1.5 not available");
+			}
+
+			// Get monitors and keep them up to date
+			xrandr::XRRSelectInput(self.display, self.window,
+					       xrandr::RRScreenChangeNotifyMask |
+					       xrandr::RRCrtcChangeNotifyMask |
+					       xrandr::RROutputChangeNotifyMask);
+		}
+
+		self.event_base = event_base;
+	}
+
+	fn update_layout(&mut self, sink: &mut dyn Sink)
+	{
+		if self.event_base == 0 {
+			self.init_randr();
+		}
+
+		self.layout = get_layout(self.display, self.window);
+		self.layout.set_zones(&self.zones);
+		self.layout_changed = false;
+		self.tracker.synced = false;
+
+		if let Some(barriers) = &mut self.barriers {
+			for b in barriers.drain(..) {
+				unsafe {
+					xfixes::XFixesDestroyPointerBarrier(self.display, b);
+				}
+			}
+			*barriers = create_barriers(self.display, self.window, &self.layout);
+		}
+
+		sink.layout(&self.layout);
+		sink.stats().startup.mark("layout");
+	}
+
+	// Handles the events queued so far
+	fn drain(&mut self, sink: &mut dyn Sink)
+	{
+		unsafe {
+			// Drain all queued events in one batch
+			while xlib::XPending(self.display) > 0 {
+				let mut event = {
+					let mut event = MaybeUninit::uninit();
+					xlib::XNextEvent(self.display, event.as_mut_ptr());
+					event.assume_init()
+				};
+
+				// Active window or its state changed?
+				if event.type_ == xlib::PropertyNotify {
+					if let Some(ewmh) = &self.ewmh {
+						let atom = event.property.atom;
+						if atom == ewmh.active_window || atom == ewmh.wm_state {
+							self.fullscreen_changed = true;
+						}
+					}
+					continue;
+				}
+
+				// Monitor setup changed?
+				if self.event_base != 0 &&
+				   (event.type_ == self.event_base + xrandr::RRScreenChangeNotify ||
+				    event.type_ == self.event_base + xrandr::RRNotify) {
+					xrandr::XRRUpdateConfiguration(&mut event);
+					self.layout_changed = true;
+					continue;
+				}
+
+				let mut cookie: xlib::XGenericEventCookie = event.generic_event_cookie;
+				xlib::XGetEventData(self.display, &mut cookie);
+
+				// Pushed against or moved away from a barrier?
+				if cookie.type_ == xlib::GenericEvent &&
+				   cookie.extension == self.major_opcode &&
+				   (cookie.evtype == xinput2::XI_BarrierHit || cookie.evtype == xinput2::XI_BarrierLeave) {
+					let barrier = &*(cookie.data as *const xinput2::XIBarrierEvent);
+					sink.stats().events += 1;
+					self.flush_motion(sink);
+
+					// Leaving reports the position off the edge, which rearms it
+					let (x, y) = (barrier.root_x as i32, barrier.root_y as i32);
+					if self.covered.map_or(false, |r| r.contains(x, y)) {
+						self.suspend(sink, true);
+					} else {
+						sink.motion(&self.layout, x, y, (barrier.dx, barrier.dy));
+					}
+				}
+
+				// Was pointer moved?
+				if cookie.type_ == xlib::GenericEvent &&
+				   cookie.extension == self.major_opcode &&
+				   cookie.evtype == xinput2::XI_RawMotion {
+					sink.stats().events += 1;
+
+					// Rebuild the cache once per burst of notifications,
+					// earlier motions still use the old one
+					if self.layout_changed {
+						self.flush_motion(sink);
+						self.update_layout(sink);
+					}
+
+					// Handled once the queue is drained
+					let (dx, dy) = raw_delta(cookie.data as *const xinput2::XIRawEvent);
+					let tracked = self.track && self.tracker.motion(dx, dy, &self.layout);
+					self.batch.add(dx, dy, tracked);
+				}
+
+				xlib::XFreeEventData(self.display, &mut cookie);
+			}
+
+			self.flush_motion(sink);
+
+			// Barriers must follow the new layout right away, no motion is coming
+			if self.barriers.is_some() && self.layout_changed {
+				self.update_layout(sink);
+			}
+
+			// No motion comes while suspended, monitors may have been added
+			if self.suspended && self.layout_changed {
+				self.update_layout(sink);
+				self.fullscreen_changed = true;
+			}
+
+			if self.fullscreen_changed {
+				self.update_suspended(sink);
+			}
+		}
+	}
+}
+
+impl Backend for Xorg {
+	fn fd(&self) -> i32
+	{
+		return unsafe { xlib::XConnectionNumber(self.display) };
+	}
+
+	fn set_zones(&mut self, zones: &Zones)
+	{
+		self.zones = *zones;
+		self.layout.set_zones(zones);
+	}
+
+	fn deadline(&self) -> Option<Instant>
+	{
+		return self.sampling.map(|(next, _, _)| next).or(self.leave_check);
+	}
+
+	fn builtin(&mut self, builtin: &Builtin) -> Result<(), String>
+	{
+		let display = self.display;
+
+		match builtin {
+			Builtin::KEY(keys) => unsafe {
+				let (mut a, mut b, mut c, mut d) = (0, 0, 0, 0);
+				if xtest::XTestQueryExtension(display, &mut a, &mut b, &mut c, &mut d) == 0 {
+					return Err("XTest not available".to_string());
+				}
+
+				let mut codes = Vec::with_capacity(keys.len());
+				for key in keys {
+					let c_str = CString::new(key.as_str()).map_err(|_| format!("invalid key: {}", key))?;
+					let code = xlib::XKeysymToKeycode(display, xlib::XStringToKeysym(c_str.as_ptr()));
+					if code == 0 {
+						return Err(format!("unknown key: {}", key));
+					}
+					codes.push(code as u32);
+				}
+
+				// Modifiers first, released in reverse
+				for &code in &codes {
+					xtest::XTestFakeKeyEvent(display, code, xlib::True, 0);
+				}
+				for &code in codes.iter().rev() {
+					xtest::XTestFakeKeyEvent(display, code, xlib::False, 0);
+				}
+			},
+			Builtin::SHOWDESKTOP => {
+				let atom = intern(display, "_NET_SHOWING_DESKTOP");
+				let showing = get_property(display, self.window, atom, xlib::XA_CARDINAL).first().copied().unwrap_or(0);
+				client_message(display, self.window, atom, (showing == 0) as c_long);
+			}
+			Builtin::DPMSOFF => unsafe {
+				if dpms::DPMSCapable(display) == xlib::False {
+					return Err("DPMS not available".to_string());
+				}
+				dpms::DPMSEnable(display);
+				dpms::DPMSForceLevel(display, dpms::DPMSModeOff);
+			},
+			Builtin::WORKSPACE(n, relative) => {
+				let atom = intern(display, "_NET_CURRENT_DESKTOP");
+				let mut index = *n;
+				if *relative {
+					let count = intern(display, "_NET_NUMBER_OF_DESKTOPS");
+					let count = get_property(display, self.window, count, xlib::XA_CARDINAL).first().copied().unwrap_or(1).max(1) as i64;
+					let current = get_property(display, self.window, atom, xlib::XA_CARDINAL).first().copied().unwrap_or(0) as i64;
+					index = (current + n).rem_euclid(count);
+				}
+				client_message(display, self.window, atom, index as c_long);
+			}
+		}
+
+		unsafe {
+			xlib::XFlush(display);
+		}
+
+		return Ok(());
+	}
+
+	fn dispatch(&mut self, sink: &mut dyn Sink)
+	{
+		// Barriers need the layout before any event can come
+		if self.barriers.is_some() && self.layout_changed {
+			self.update_layout(sink);
+		}
+
+		self.sample(sink);
+		self.check_leave(sink);
+
+		// Round trips while draining read events into the Xlib queue
+		// where poll doesn't see them, so drain until none are left
+		loop {
+			self.drain(sink);
+			if !self.pending() {
+				break;
+			}
+		}
+	}
+
+	fn pending(&self) -> bool
+	{
+		return unsafe { xlib::XEventsQueued(self.display, xlib::QueuedAlready) } > 0;
+	}
+}
+
+impl Drop for Xorg {
+	fn drop(&mut self)
+	{
+		unsafe {
+			for b in self.barriers.iter().flatten() {
+				xfixes::XFixesDestroyPointerBarrier(self.display, *b);
+			}
+			xlib::XCloseDisplay(self.display);
+		}
+	}
+}